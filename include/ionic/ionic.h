@@ -6,6 +6,20 @@
 #include <ostream>
 #include <optional>
 #include <algorithm>
+#include <string_view>
+#include <mutex>
+#include <type_traits>
+#include <initializer_list>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <memory_resource>
+
+// Compile with IONIC_STATS=1 (or the IONIC_STATS CMake option) to collect the
+// performance stats reported by Table::stats(). When it is 0, nothing is measured.
+#ifndef IONIC_STATS
+#define IONIC_STATS 0
+#endif
 
 namespace ionic {
 
@@ -63,10 +77,70 @@ Color strToColor(const std::string& str);
 // Returns the terminal code for the given color.
 std::string colorCode(Color color);
 
+// When tables are rendered with color (and style) escapes.
+enum class ColorPolicy {
+    global,     // as the process wide Table::colorEnabled says (the default)
+    always,
+    never,
+    automatic,  // if stdout is a terminal, and NO_COLOR isn't set
+};
+
 enum class Alignment {
     left,
     right,
     center,
+    decimal,    // right aligned, with the decimal points of the column lined up (the default for numbers)
+};
+
+// A terminal color: the default, one of the 16 Colors, an entry of the 256 color
+// palette, or 24-bit RGB ("truecolor"). Not every terminal supports the last two.
+struct TermColor {
+    enum class Kind : uint8_t { none, basic, index256, rgb };
+
+    TermColor() = default;
+    TermColor(Color c);     // Color::kDefault and Color::reset are the default color
+    static TermColor index256(uint8_t index);
+    static TermColor rgb(uint8_t r, uint8_t g, uint8_t b);
+
+    Kind kind = Kind::none;
+    uint8_t value[3] = {};  // basic: the Color, index256: the index, rgb: r, g, b
+
+    bool operator==(const TermColor& rhs) const {
+        return kind == rhs.kind && value[0] == rhs.value[0] && value[1] == rhs.value[1] && value[2] == rhs.value[2];
+    }
+    bool operator!=(const TermColor& rhs) const { return !(*this == rhs); }
+};
+
+// How a cell is drawn. A Table interns the distinct styles into a palette, so each
+// cell only stores a small index, and each style's escape sequence is built once.
+struct Style {
+    TermColor fg;
+    TermColor bg;
+    bool bold = false;
+    bool dim = false;
+    bool underline = false;
+    Alignment alignment = Alignment::left;
+
+    bool operator==(const Style& rhs) const {
+        return fg == rhs.fg && bg == rhs.bg && bold == rhs.bold && dim == rhs.dim
+            && underline == rhs.underline && alignment == rhs.alignment;
+    }
+    bool operator!=(const Style& rhs) const { return !(*this == rhs); }
+};
+
+// Returns the terminal code that starts the style: a single escape sequence, or
+// an empty string for the default colors with no attributes.
+std::string styleCode(const Style& style);
+
+// The lines the border is drawn with. ascii uses the border chars of TableOptions; the
+// others are Unicode box drawing characters (UTF-8), with distinct corners, tees and
+// crossings. Most terminals, but not all fonts, have them.
+enum class BorderStyle {
+    ascii,
+    light,      // thin lines
+    heavy,      // thick lines
+    doubleLine, // double lines
+    rounded,    // thin lines with rounded outer corners
 };
 
 enum class ColType {
@@ -74,6 +148,67 @@ enum class ColType {
     fixed, 	    // specified width
 };
 
+// How numbers added with Table::addRow() are written. (Text is always written as-is.)
+enum class ValueFormat {
+    automatic,  // integers as integers, floating point in the shortest form that round trips
+    integer,    // rounded to an integer
+    floating,   // fixed point, with the column precision
+    bytes,      // a byte count: 512 B, 1.50 KiB, 3.20 GiB
+    duration,   // seconds: 350.00 us, 1.25 s, 2.50 h
+};
+
+// A summary of the numbers in a column, for footer rows.
+enum class Aggregate {
+    none,       // no value (the cell is blank, or has the footer's label)
+    count,      // how many numbers there are
+    sum,
+    min,
+    max,
+    mean,
+};
+
+// A value for a cell: text, or a number that is formatted (with std::to_chars) by
+// the ValueFormat of its column. Text isn't copied until it is added to the table,
+// except for a temporary std::string, which the Value keeps so it can't dangle.
+class Value {
+public:
+    enum class Type : uint8_t { text, integer, unsignedInteger, floating };
+
+    Value(const char* s) : _text(s ? s : "") {}
+    Value(std::string_view s) : _text(s) {}
+    Value(const std::string& s) : _text(s) {}
+    Value(std::string&& s) : _owned(std::make_shared<const std::string>(std::move(s))), _text(*_owned) {}
+
+    template<class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>, int> = 0>
+    Value(T v) {
+        if constexpr (std::is_signed_v<T>) {
+            _type = Type::integer;
+            _i = v;
+        }
+        else {
+            _type = Type::unsignedInteger;
+            _u = v;
+        }
+    }
+    Value(double v) : _type(Type::floating), _d(v) {}
+    Value(float v) : _type(Type::floating), _d(v) {}
+
+    Type type() const { return _type; }
+    std::string_view text() const { return _text; }
+    int64_t toInt() const;
+    double toDouble() const;
+
+private:
+    Type _type = Type::text;
+    union {
+        int64_t _i = 0;
+        uint64_t _u;
+        double _d;
+    };
+    std::shared_ptr<const std::string> _owned;     // the text, if it was a temporary
+    std::string_view _text;
+};
+
 struct TableOptions {
     bool outerBorder = true;                    // true to draw the outer border
     bool innerHDivider = true;				    // true to draw horizontal dividers between rows
@@ -82,6 +217,7 @@ struct TableOptions {
     char borderHChar = '-';                     // specify characters for the border
     char borderVChar = '|';                     // specify characters for the border
     char borderCornerChar = '+';                // specify characters for the border
+    BorderStyle borderStyle = BorderStyle::ascii;   // other than ascii, the border chars aren't used
     
     int  maxWidth = -1;                         // positive will use that value; <=0 will use console width
     int  indent = 0;                            // number of spaces to indent the table (reduces width)
@@ -89,6 +225,66 @@ struct TableOptions {
     Color tableColor = Color::kDefault;         // color of the table border and dividers
     Color textColor = Color::kDefault;		    // default color of the text - can be overridden for individual cells
     Alignment alignment = Alignment::left;	    // default alignment of the text - can be overridden for individual cells
+    ColorPolicy color = ColorPolicy::global;    // when to write color escapes - can be overridden per render
+
+    // Approximate layout, for previews of very large tables. When widthSampleRows is positive,
+    // flex column widths are estimated from about that many rows, sampled evenly across the
+    // table, so computing the layout doesn't depend on the number of rows. The width used is
+    // the widthSampleQuantile of the sampled widths: 1 is the widest sampled cell, and smaller
+    // values ignore the widest outliers (which are then wrapped or truncated).
+    int widthSampleRows = 0;
+    double widthSampleQuantile = 1.0;
+
+    // Row budget. If headRows is 0 or more, and the table has more than headRows + tailRows
+    // rows, only the first headRows and the last tailRows rows are rendered, with one
+    // "... N more rows" line in between (or "+N" where that doesn't fit in maxWidth). The
+    // rows left out aren't measured or wrapped.
+    int headRows = -1;
+    int tailRows = 0;
+
+    // Column dropping, for narrow terminals. If dropWidth is positive and the visible columns
+    // don't fit with every flex column at least dropWidth wide, columns are left out, lowest
+    // Column::priority first (and on a tie, the rightmost), until they do. One column is
+    // always kept.
+    int dropWidth = 0;
+
+    char footerHChar = '=';                     // the line between the rows and the footer rows
+
+    // Memory budget, in bytes of cell text. If it is positive, whenever the text of the
+    // rows in memory goes over it, that text is appended to a temporary file as one
+    // segment. The widths, line counts and styles stay in memory, so the layout doesn't
+    // read the text; format() reads each segment back with one large read, as it gets to it.
+    // Views read it in table order too, whatever their order, and keep the text of their
+    // spilled rows in memory for the render.
+    size_t memoryBudget = 0;
+
+    // Bounded tables, for "recent events" panels. If maxRows is positive, only the last
+    // maxRows rows are kept: adding a row past that drops the oldest, in O(1). The widest
+    // cells of each column are kept up to date as rows come and go, so the layout doesn't
+    // scan the rows. (Footer aggregates still count every row added. memoryBudget isn't
+    // used; the rows kept are the bound.)
+    int maxRows = 0;
+};
+
+// Where the time goes in a Table. Only collected when compiled with IONIC_STATS;
+// otherwise everything stays zero. Times are in seconds, and everything accumulates
+// until Table::resetStats().
+struct TableStats {
+    double ingestTime = 0;      // normalizing and measuring cells in addRow() (and Appenders)
+    double layoutTime = 0;      // computing the column widths
+    double wrapTime = 0;        // word wrapping the cells
+    double emitTime = 0;        // building the output, other than layout and wrapping
+    double writeTime = 0;       // writing the output in print()
+
+    uint64_t rowsAdded = 0;
+    uint64_t formats = 0;       // calls to format(), including from print()
+    uint64_t cellsWrapped = 0;
+    uint64_t linesEmitted = 0;  // including border lines
+    uint64_t truncations = 0;   // cell lines cut short with the ellipsis
+    uint64_t textBytes = 0;     // bytes of cell text written to the output
+    uint64_t escapeBytes = 0;   // bytes of color escape codes written to the output
+    uint64_t spillReads = 0;    // segments of spilled text read back (see memoryBudget)
+    uint64_t cellBytes = 0;     // memory used by the cells, computed by stats()
 };
 
 /*
@@ -100,51 +296,158 @@ struct TableOptions {
 *      Use setCell(), setRow(), setColumn(), and setTable().
 *   5. Call format() to get the formatted table as a string, or print() to print it to the console,
 *      or use the << operator to print it to an ostream.
+*
+*   Rows can also be added from several threads at once with Table::Appender (see below.)
 */
 class Table {
     friend class IonicTest;
+    friend class MappedTable;
+    friend class TableView;
+    friend class Renderer;
 public:
+    // Process wide, for ColorPolicy::global. Prefer a ColorPolicy where tables are
+    // rendered for different outputs at the same time.
     static bool colorEnabled;
 
-    Table(const TableOptions& options = TableOptions()) : _options(options) {}
+    // The cell storage (the rows, cell text, escape indices and dictionaries) and
+    // snapshots are allocated from the memory resource, which must outlive the table
+    // and its snapshots. The rest stays on the default heap: the column formats,
+    // styles, footers and aggregates, the list of spilled segments, and with maxRows
+    // the maxima (up to maxRows entries per column). Rows from Appenders and addRows()
+    // are prepared on the default resource, as those threads can't share an arena, and
+    // copied in as they are added. A bounded table (maxRows) frees the segments of the
+    // rows it drops into the resource, so it needs one that reuses memory, such as a
+    // pool: on a monotonic_buffer_resource it grows without limit. A snapshot (and
+    // the row segments it shares) is freed on whichever thread drops it last, so a
+    // table whose snapshots go to other threads needs a thread-safe resource: the
+    // default, or a std::pmr::synchronized_pool_resource, not an unsynchronized one.
+    Table(const TableOptions& options = TableOptions(), std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 
     struct Column {
         ColType type = ColType::flex;
         int requestedWidth = 0;
+        ValueFormat format = ValueFormat::automatic;   // how numbers in this column are written
+        int precision = 2;                              // digits after the decimal point, where used
+        bool visible = true;                            // hidden columns aren't laid out or rendered
+        int priority = 0;                               // with TableOptions::dropWidth, lower is dropped first
+        bool truncate = false;                          // one line per row: the first line, cut to the width (not wrapped)
+        bool dictionary = false;                        // store each distinct value once (for columns with few distinct values)
     };
     void setColumnFormat(const std::vector<Column>& cols);
+    // Hiding a column doesn't change its cells; it is just skipped by format().
+    void setColumnVisible(int col, bool visible) { _cols[col].visible = visible; }
+    void setColumnPriority(int col, int priority) { _cols[col].priority = priority; }
     void addRow(const std::vector<std::string>& row);
+    // Rows can mix text and numbers: addRow({ "latency", 12.5, 3 }). Numbers are written
+    // straight into the cell, and are aligned on the decimal point by default.
+    void addRow(std::initializer_list<Value> row);
+    void addRow(const std::vector<Value>& row);
+    // Adds many rows at once, with the same result as calling addRow() for each. The
+    // cells are normalized and measured in parallel, over nThreads threads (0 for one
+    // per core), and the table's storage is reserved up front.
+    void addRows(const std::vector<std::vector<std::string>>& rows, int nThreads = 0);
+    void addRows(const std::vector<std::vector<Value>>& rows, int nThreads = 0);
+
+    // Concurrent ingestion. Each producer thread creates its own Appender and adds rows
+    // to it; rows are prepared on the producer thread and handed to the table in batches,
+    // so producers only briefly share a lock once per batch. merge() then moves the
+    // flushed batches into the table. Call it from one thread once the producers are done
+    // (or have flushed), before format() or any other use of the rows. Rows from one
+    // Appender stay in order; batches from different Appenders are in flush order.
+    // While Appenders are active, don't call addRow(), setColumnFormat() or addFooter().
+    class Appender;
+    void merge();
+
+    // Footer rows summarize the numbers in each column. The footer has one Aggregate per
+    // column, which defines what is kept for the column: from then on, the aggregates
+    // are kept up to date as rows are added, at O(1) per number, so a footer never needs
+    // another pass over the table. Columns without an aggregate cost nothing. Numbers
+    // are the finite numeric Values added, and text cells that are a finite number. The
+    // label goes in the first column with Aggregate::none. Footers are rendered by
+    // format(), after a line of footerHChar. (Views and saved snapshots, opened as
+    // MappedTable, don't have them; snapshot() copies keep them.)
+    // A footer that aggregates a column for the first time after rows were added makes
+    // one pass over the rows in the table to catch up, parsing their text: numbers shown
+    // with a unit or rounded count as shown, and rows dropped with maxRows aren't
+    // counted. Don't add footers while Appenders are active.
+    void addFooter(const std::string& label, const std::vector<Aggregate>& aggregates);
+    // Removes the footers and their aggregates.
+    void clearFooters() { _footers.clear(); _aggregated.clear(); _aggregates.clear(); }
 
     void setCell(int row, int col, std::optional<Color>, std::optional<Alignment>);
     void setRow(int row, std::optional<Color>, std::optional<Alignment>);
     void setColumn(int col, std::optional<Color>, std::optional<Alignment>);
     void setTable(std::optional<Color>, std::optional<Alignment>);
+    // Sets the whole style: colors (including 256 color and RGB), attributes, and
+    // alignment. A table can have up to kMaxStyles distinct styles; past that, cells
+    // keep the style they had.
+    void setCell(int row, int col, const Style& style);
+    void setRow(int row, const Style& style);
+    void setColumn(int col, const Style& style);
+    void setTable(const Style& style);
 
     std::string format() const;
+    // Renders with the color policy, in place of the one in the options. Renders
+    // of the same table with different policies can run at the same time.
+    std::string format(ColorPolicy color) const;
     void print() const;
 
+    // Writes a binary snapshot of the table (options, column formats, cell text,
+    // styles, and the measured widths and line counts) that can be opened with
+    // MappedTable. Returns false if the file can't be written.
+    bool save(const std::string& path) const;
+
+    // An immutable copy of the table that can be rendered on another thread while
+    // this one keeps adding rows. The rows (with their escape indices) are shared in
+    // segments of 1024, and the dictionaries whole, so taking one is O(segments) rather
+    // than O(cells); a shared segment or dictionary is copied the first time this table
+    // changes it. Take it on the thread that changes the table (or
+    // under the same lock). Rows waiting in Appender batches aren't included. It is
+    // allocated from the table's memory resource (see the constructor).
+    std::shared_ptr<const Table> snapshot() const;
+
     friend std::ostream& operator<<(std::ostream& os, const Table& t) {
         os << t.format();
         return os;
     }
 
+    // Stats are only collected when compiled with IONIC_STATS. Note that collecting
+    // them means concurrent format() calls on the same Table aren't safe.
+    TableStats stats() const;
+    void resetStats();
+
     // -- Query -- //
     int nRows() const { return static_cast<int>(_rows.size()); }
     int nCols() const { return static_cast<int>(_cols.size()); }
+    const Column& column(int col) const { return _cols[col]; }
+    // The aggregate of the numbers in the column so far, if a footer aggregates the
+    // column. NaN if there are no numbers (except for count and sum, which are 0).
+    double aggregate(int col, Aggregate aggregate) const;
+    const Style& style(int row, int col) const { return _styles[_rows[row][col].style]; }
+    int nStyles() const { return static_cast<int>(_styles.size()); }
+    // Rows whose text is on disk, with TableOptions::memoryBudget. These are the first rows.
+    int nSpilledRows() const { return _spilledRows; }
 
     // -- Constants --
     static constexpr char kWhitespace[] = " \t\n\r";
     static constexpr char kSpace[] = " \t";
     static constexpr char kEllipsis[] = "..";
     static constexpr int kMinWidth = 3;         // minimum column width for flex columns
+    static constexpr int kMaxStyles = 65536;    // distinct styles per table
 
     // Utility functions
     // Query the terminal width.
     static int consoleWidth();
 
     // Returns a string wrapped with the given color. The color is reset at the end.
-    // This does check the colorEnabled flag.
-    static std::string colorize(Color c, const std::string& s);
+    // This does check the color policy (by default, the colorEnabled flag).
+    static std::string colorize(Color c, const std::string& s, ColorPolicy color = ColorPolicy::global);
+
+    // Whether the policy means color. ColorPolicy::automatic checks stdout once.
+    static bool useColor(ColorPolicy color);
+    // ColorPolicy::always if fd is a terminal (and NO_COLOR isn't set), else never.
+    // For output that doesn't go to stdout.
+    static ColorPolicy detectColor(int fd);
 
     struct Break {
         size_t start = 0;   // start of the line
@@ -152,61 +455,522 @@ public:
         size_t next = 0;    // internal use
     };
 
+    // Terminal escape sequences in cell text (from colorize() or another tool) take no
+    // space on screen. Cells with escapes keep an index of them, built when the cell
+    // is added, so they are measured, wrapped and truncated by what is visible.
+    struct Escape {
+        uint32_t pos = 0;       // where the sequence starts
+        uint32_t size = 0;
+        uint32_t before = 0;    // bytes of the sequences before this one
+    };
+    // Allocator aware, like the cells, so a table keeps them in its memory resource.
+    struct Escapes {
+        using allocator_type = std::pmr::polymorphic_allocator<Escape>;
+
+        Escapes() = default;
+        explicit Escapes(const allocator_type& alloc) : escapes(alloc) {}
+        Escapes(const Escapes& rhs, const allocator_type& alloc) : escapes(rhs.escapes, alloc) {}
+        Escapes(Escapes&& rhs, const allocator_type& alloc) : escapes(std::move(rhs.escapes), alloc) {}
+        Escapes(const Escapes&) = default;
+        Escapes(Escapes&&) = default;
+        Escapes& operator=(const Escapes&) = default;
+        Escapes& operator=(Escapes&&) = default;
+
+        std::pmr::vector<Escape> escapes;
+
+        // The visible width of text[start, end), which doesn't split a sequence.
+        size_t visibleWidth(size_t start, size_t end) const;
+    };
+    // Finds the escape sequences: CSI (ESC [ ... final byte), or ESC and one byte.
+    // Returns false if there aren't any.
+    static bool findEscapes(std::string_view text, Escapes& escapes);
+    // The size of the escape sequence at text[pos], or 0 if there isn't one.
+    static size_t escapeSize(std::string_view text, size_t pos);
+
     // Breaks the text into lines of the given width.
     // NOTE: Ionic is very low-ascii English. (Which sholud be fixed.)
     // But this call (and all of them) assume a 1-char is 1-glyph relationship.
     // params:
     // text: the input string
     // width: width to break on, or 0 to query console
-    static std::vector<Break> wordWrap(const std::string& text, int width);
+    static std::vector<Break> wordWrap(std::string_view text, int width);
+    // As above, but into lines (which is cleared first), so its memory can be reused.
+    // With escapes (from findEscapes()), widths don't count the escape sequences.
+    static void wordWrap(std::string_view text, int width, std::vector<Break>& lines, const Escapes* escapes = nullptr);
 
 
 private:
     static void initConsole();
 
-    // Remove CR.
-    static void normalizeNL(std::string& s) {
+    // Remove CR. (For std::string and std::pmr::string.)
+    template<class S>
+    static void normalizeNL(S& s) {
         s.erase(std::remove(s.begin(), s.end(), '\r'), s.end());
     }
     // Remove trailing spaces.
-    static void trimRight(std::string& s) {
+    template<class S>
+    static void trimRight(S& s) {
         // The npos behavior is weird. If the string is all whitespace, it returns npos. npos+1 is 0,
         // which then returns nothing (which is correct.)
 		s.erase(s.find_last_not_of(kWhitespace) + 1);
 	}
+    // Writes a number in the format, for a cell. Text values are returned as-is.
+    static std::string formatValue(const Value& value, ValueFormat format, int precision);
+
     // Find the number of lines, and the maximum width of the lines.
-    static int nLines(const std::string&, int& maxWidth);
+    static int nLines(std::string_view, int& maxWidth, const Escapes* escapes = nullptr);
 
     // Breaks a single line - usually called by wordWrap.
-    static Break lineBreak(const std::string& text, size_t start, size_t end, int width);
+    static Break lineBreak(std::string_view text, size_t start, size_t end, int width, const Escapes* escapes = nullptr);
 
+    using StyleIndex = uint16_t;
+    static constexpr StyleIndex kTextStyle = 0;     // the options' text color and alignment
+
+    // Cells are allocator aware, so a row allocates its cells' text from its own
+    // memory resource (and moving a cell to a row with another resource copies it).
     struct Cell {
-		std::string text;
+        using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+        Cell() = default;
+        explicit Cell(const allocator_type& alloc) : text(alloc) {}
+        Cell(const Cell& rhs, const allocator_type& alloc) : Cell(alloc) { copyFrom(rhs); text = rhs.text; }
+        Cell(Cell&& rhs, const allocator_type& alloc) : Cell(alloc) { copyFrom(rhs); text = std::move(rhs.text); }
+        Cell(const Cell&) = default;
+        Cell(Cell&&) = default;
+        Cell& operator=(const Cell&) = default;
+        Cell& operator=(Cell&&) = default;
+
+		std::pmr::string text;
         int desiredWidth = 0;
         int nLines = 0;
-        Color color = Color::kDefault;
-        Alignment alignment = Alignment::left;
+        StyleIndex style = kTextStyle;
+        uint16_t firstWidth = 0;        // of the first line, all a truncated column shows (clamped like the decimal widths)
+        int value = -1;                 // in a dictionary column, the index of the text in the dictionary
+        int escapes = -1;               // the index of the text's escape sequences, in its row segment (or
+                                        // the dictionary), or -1 if it has none
+        // For decimal alignment: the widest parts of the lines before and from the decimal
+        // point, measured as the cell is added so that the layout doesn't need the text.
+        uint16_t decimalInt = 0;
+        uint16_t decimalFrac = 0;
+
+    private:
+        void copyFrom(const Cell& rhs) {    // everything but the text
+            desiredWidth = rhs.desiredWidth;
+            nLines = rhs.nLines;
+            style = rhs.style;
+            firstWidth = rhs.firstWidth;
+            value = rhs.value;
+            escapes = rhs.escapes;
+            decimalInt = rhs.decimalInt;
+            decimalFrac = rhs.decimalFrac;
+        }
 	};
+    using Row = std::pmr::vector<Cell>;
+    // Cell::escapes of prepared text that has escapes. They are indexed when the row is added
+    // (by Rows::push_back(), or encode() for a dictionary column).
+    static constexpr int kFindEscapes = -2;
+
+    // The distinct values of a dictionary column. A cell's text is moved into the
+    // dictionary (and the cell's own text left empty) if it isn't there already.
+    // Copies keep the memory resource.
+    struct Dictionary {
+        explicit Dictionary(std::pmr::memory_resource* resource) : values(resource), index(resource), escapes(resource) {}
+        Dictionary(const Dictionary& rhs) : values(rhs.values, rhs.values.get_allocator()), index(rhs.index, rhs.index.get_allocator()),
+            escapes(rhs.escapes, rhs.escapes.get_allocator()) {}
+        Dictionary(Dictionary&&) = default;
+        Dictionary& operator=(const Dictionary&) = default;
+        Dictionary& operator=(Dictionary&&) = default;
+
+        std::pmr::vector<std::pmr::string> values;
+        std::pmr::unordered_map<std::pmr::string, int> index;
+        std::pmr::vector<Escapes> escapes;  // by value, up to the last one with escapes
+    };
+
+    // Shared by copies of the table until one of them changes it, like the row segments,
+    // so that taking a snapshot doesn't copy it. The copy keeps the memory resource.
+    template<class T>
+    class Shared {
+    public:
+        explicit Shared(std::pmr::memory_resource* resource)
+            : _ptr(std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(resource), resource)), _resource(resource) {}
+        Shared(const Shared& rhs) : _ptr(rhs._ptr), _resource(rhs._resource), _shared(true) { rhs._shared = true; }
+        Shared& operator=(const Shared& rhs) {
+            rhs._shared = true;
+            _ptr = rhs._ptr;
+            _resource = rhs._resource;
+            _shared = true;
+            return *this;
+        }
+        Shared(Shared&&) = default;
+        Shared& operator=(Shared&&) = default;
+
+        const T& operator*() const { return *_ptr; }
+        const T* operator->() const { return _ptr.get(); }
+        // For changing it. Copies it first, if that is shared.
+        T& edit() {
+            if (_shared) {
+                _ptr = std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(_resource), *_ptr);
+                _shared = false;
+            }
+            return *_ptr;
+        }
+
+    private:
+        std::shared_ptr<T> _ptr;
+        std::pmr::memory_resource* _resource;
+        mutable bool _shared = false;   // a copy may have it too
+    };
 
-    struct Dye {
-        Dye(Color c, std::string& s);
-        ~Dye();
+    // The running count, sum, min, and max of the numbers in a column.
+    struct Accumulator {
+        uint64_t count = 0;
+        double sum = 0;
+        double min = 0;
+        double max = 0;
 
-      private:
-        Color _c;
-		std::string& _s;
+        void add(double v);
+        void add(const Accumulator& rhs);
+        double value(Aggregate aggregate) const;
+    };
+
+    struct Footer {
+        std::string label;
+        std::vector<Aggregate> aggregates;
+    };
+
+    // Batches flushed by Appenders, waiting for merge().
+    struct Pending {
+        Pending() = default;
+        Pending(const Pending& rhs);
+        Pending& operator=(const Pending& rhs);
+
+        mutable std::mutex mutex;
+        std::vector<std::vector<Row>> batches;
+        std::vector<Accumulator> aggregates;
+        double ingestTime = 0;
+    };
+
+    // The rows, in segments of kSegmentRows. Copies of Rows share the segments, and
+    // a shared segment is copied before it is changed, so a copy costs O(segments).
+    class Rows {
+    public:
+        static constexpr size_t kSegmentRows = 1024;
+
+        explicit Rows(std::pmr::memory_resource* resource) : _segments(resource), _resource(resource) {}
+        Rows(const Rows& rhs) : Rows(rhs._resource) { *this = rhs; }
+        Rows& operator=(const Rows& rhs);
+        Rows(Rows&&) = default;
+        Rows& operator=(Rows&&) = default;
+
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        const Row& operator[](size_t r) const {
+            r += _first;
+            return _segments[r / kSegmentRows].segment->rows[r % kSegmentRows];
+        }
+        // For changing a row. Copies its segment first, if that is shared.
+        Row& edit(size_t r);
+        // Adds the row, and indexes the escape sequences of its cells (see kFindEscapes).
+        void push_back(Row&& row);
+        // The escape sequences of a cell of row r, by its Cell::escapes.
+        const Escapes& escapes(size_t r, int index) const {
+            r += _first;
+            return _segments[r / kSegmentRows].segment->escapes[size_t(index)];
+        }
+        // Drops the first row. Its memory is freed with the rest of its segment.
+        void pop_front();
+        void reserve(size_t n) { _segments.reserve((_first + n + kSegmentRows - 1) / kSegmentRows); }
+        // Memory used by the rows, not counting the cell text.
+        size_t bytes() const;
+
+    private:
+        struct Segment {
+            explicit Segment(std::pmr::memory_resource* resource) : rows(resource), escapes(resource) {}
+            Segment(const Segment& rhs, std::pmr::memory_resource* resource) : rows(rhs.rows, resource), escapes(rhs.escapes, resource) {}
+
+            std::pmr::vector<Row> rows;
+            std::pmr::vector<Escapes> escapes;  // of the rows' cells that have them, by Cell::escapes
+        };
+        struct Ref {
+            std::shared_ptr<Segment> segment;
+            bool shared = false;    // a copy may have the segment too
+        };
+        mutable std::pmr::vector<Ref> _segments;
+        std::pmr::memory_resource* _resource;
+        size_t _first = 0;      // rows dropped from the first segment
+        size_t _size = 0;
+
+        Segment& own(Ref& ref);
     };
 
     TableOptions _options;
+    std::pmr::memory_resource* _resource;
     std::vector<Column> _cols;
-    std::vector<std::vector<Cell>> _rows;
+    Rows _rows;
+    Pending _pending;
+    mutable TableStats _stats;
+
+    // The style palette. Cells index into _styles, and _styleCodes holds the
+    // escape sequence for each.
+    std::vector<Style> _styles;
+    std::vector<std::string> _styleCodes;
+    std::unordered_map<uint64_t, StyleIndex> _styleIndex;
+    StyleIndex _numberStyle = kTextStyle;
+
+    std::vector<Accumulator> _aggregates;   // per column
+    std::vector<char> _aggregated;          // per column, whether a footer aggregates it
+    std::vector<Footer> _footers;
+    std::vector<Shared<Dictionary>> _dictionaries;  // per column, for the dictionary columns
+
+    // Spilled text. Each segment is a run of rows, stored as the size (uint32_t) and
+    // text of each cell. The file is shared by copies of the table; each only appends.
+    struct SpillFile;
+    struct Segment {
+        int firstRow = 0;
+        int nRows = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+    std::shared_ptr<SpillFile> _spill;
+    std::vector<Segment> _segments;
+    int _spilledRows = 0;
+    size_t _residentBytes = 0;      // of text not spilled
+
+    // The maximum of a value over a sliding window of rows: (row number, value) with
+    // the values decreasing, so the front is the maximum. Rows are numbered from the
+    // first row ever added, and each is pushed and popped at most once.
+    struct MaxQueue {
+        std::deque<std::pair<uint64_t, int>> q;
+
+        void push(uint64_t row, int value);
+        void drop(uint64_t row) {    // drops the rows up to and including row
+            while (!q.empty() && q.front().first <= row)
+                q.pop_front();
+        }
+        int max() const { return q.empty() ? 0 : q.front().second; }
+    };
+    // With TableOptions::maxRows, per column: the widest cell, and the widest parts of
+    // the decimal aligned cells before and after the decimal point.
+    struct Maxima {
+        MaxQueue width;
+        MaxQueue decimalInt;
+        MaxQueue decimalFrac;
+    };
+    std::vector<Maxima> _maxima;
+    uint64_t _dropped = 0;          // rows dropped with maxRows; row r is number _dropped + r
+    bool _maximaStale = false;      // a cell's decimal alignment or a column's truncation changed; rebuilt on the next add
+
+    // Per column, whether any cell has been decimal aligned. The layout only scans a
+    // fixed column's cells if it has. (It isn't cleared, so it errs on the side of scanning.)
+    std::vector<char> _decimalCols;
+
+    // Moves the text of the dictionary columns into the dictionaries (with the index of
+    // its escape sequences). Returns the bytes of text left in the row.
+    size_t encode(Row& row);
+    // Encodes and adds a prepared row, dropping the oldest with maxRows. Returns the
+    // bytes of text it adds, for addResident().
+    size_t push(Row&& row);
+    // Adds row r to the maxima.
+    void measure(size_t r);
+    // Sets the style of a cell in the column, noting if that changes whether it is decimal aligned.
+    void restyle(Cell& cell, size_t col, StyleIndex style);
+    void markDecimal(size_t col);
+    // Counts the bytes of text added, and spills if that's over the budget.
+    void addResident(size_t bytes);
+    void spill();
+
+    // Finds or adds the style. Returns false if the palette is full.
+    bool intern(const Style& style, StyleIndex& index);
+
+    // Normalizes and measures a row of text. Doesn't modify the table.
+    void prepareRow(const std::vector<std::string>& row, Row& cells) const;
+    void prepareText(std::string_view text, Cell& cell) const;
+    void addValues(const Value* values, size_t n);
+    // Prepares the cells of a row of values, calling number(col, value) for each number
+    // in an aggregated column.
+    template<class F>
+    void prepareValues(const Value* values, size_t n, Row& cells, F&& number) const;
+    // Adds rows prepared by addRows(), with numbers[row * nCols + col] for the aggregates (NaN
+    // if none). numbers is empty if no column is aggregated.
+    void addPrepared(std::vector<Row>& rows, const std::vector<double>& numbers);
+    bool aggregated(size_t col) const { return col < _aggregated.size() && _aggregated[col]; }
+    bool aggregating() const { return !_aggregated.empty(); }     // any column
+    // Adds the numbers in the text of the aggregated columns to the aggregates.
+    void accumulate(const Row& cells, std::vector<Accumulator>& aggregates) const;
+
+    struct Source;      // read access for the shared layout and render code
+};
+
+class Table::Appender {
+public:
+    // batchRows is the number of rows collected before they are handed to the table.
+    explicit Appender(Table& table, size_t batchRows = 256) : _table(table), _batchRows(batchRows) {}
+    ~Appender() { flush(); }
+
+    Appender(const Appender&) = delete;
+    Appender& operator=(const Appender&) = delete;
+
+    void addRow(const std::vector<std::string>& row);
+    // Hands the collected rows to the table. They are added at the next merge().
+    void flush();
 
-    std::vector<int> computeWidths(const int width) const;   // returns inner column sizes for the given width
+private:
+    Table& _table;
+    size_t _batchRows;
+    std::vector<Row> _rows;
+    std::vector<Accumulator> _aggregates;
+    double _ingestTime = 0;
+};
+
+class TableView;
+class MappedTable;
+
+/*
+*   Renders tables into an output string that it keeps between renders, along with
+*   all its other scratch space (wrapped lines, column widths, borders). Once the
+*   buffers have grown to fit, re-rendering in a refresh loop doesn't allocate.
+*   One Renderer can render any number of tables, but only on one thread at a time.
+*/
+class Renderer {
+public:
+    Renderer();
+    ~Renderer();
+    Renderer(Renderer&&) noexcept;
+    Renderer& operator=(Renderer&&) noexcept;
+
+    // The returned string belongs to the Renderer, and is valid until the next render.
+    const std::string& render(const Table& table);
+    const std::string& render(const TableView& view);
+    const std::string& render(const MappedTable& table);
+
+    // Renders with this color policy, rather than each table's own.
+    void setColorPolicy(ColorPolicy color) { _color = color; }
+
+    struct Scratch;     // internal
+
+private:
+    std::unique_ptr<Scratch> _scratch;
+    std::optional<ColorPolicy> _color;
+};
+
+enum class SortOrder {
+    ascending,
+    descending,
+};
+
+enum class SortKey {
+    lexical,    // compare the text
+    numeric,    // compare the leading number of the text; cells without one sort last
+};
+
+/*
+*   A view of some or all of a Table's rows, in any order: for example, the 20 slowest
+*   requests of a large table. A view holds row indices, never copies of the cells,
+*   and renders with the table's options and column formats. The table must outlive
+*   the view, and not change while the view is in use.
+*/
+class TableView {
+public:
+    // All the rows of the table, in table order.
+    explicit TableView(const Table& table);
+
+    // Sorts the rows of the view by the column. Sorts are stable, so they can be
+    // chained: sort by the secondary key, then by the primary one.
+    TableView& sortBy(int col, SortKey key = SortKey::lexical, SortOrder order = SortOrder::ascending);
+    // Keeps only the first k rows of the view in the given order (a partial sort,
+    // which is much faster than sorting when k is small.)
+    TableView& topK(int col, int k, SortKey key = SortKey::numeric, SortOrder order = SortOrder::descending);
+    // Back to all the rows, in table order.
+    void reset();
+
+    // By default, column widths fit the rows in the view. If true, they are computed
+    // from the whole table, so the columns don't change width as the view changes.
+    void setLayoutFromTable(bool fromTable) { _layoutFromTable = fromTable; }
 
-    void printHorizontalBorder(std::string& s, const std::vector<int>& innerColWidth, bool outer) const;
-    void printLeft(std::string& s) const;
-    void printCenter(std::string& s) const;
-    void printRight(std::string& s) const;
+    std::string format() const;
+    std::string format(ColorPolicy color) const;
+    void print() const;
+
+    friend std::ostream& operator<<(std::ostream& os, const TableView& v) {
+        os << v.format();
+        return os;
+    }
+
+    // -- Query -- //
+    int nRows() const { return static_cast<int>(_rows.size()); }
+    const std::vector<int>& rows() const { return _rows; }     // table row of each view row
+
+private:
+    friend class Renderer;
+    struct Source;
+
+    template<class F>
+    void order(int col, SortKey key, SortOrder order, F&& sort);
+    void render(Renderer::Scratch& scratch, bool color) const;
+
+    const Table& _table;
+    std::vector<int> _rows;
+    bool _layoutFromTable = false;
+};
+
+/*
+*   A read-only table opened from a snapshot written by Table::save(). The file is
+*   memory mapped and format() renders directly from the mapped pages: opening does
+*   no per-cell parsing, and the pages are shared between processes that open the
+*   same snapshot.
+*/
+class MappedTable {
+public:
+    MappedTable() = default;
+    ~MappedTable() { close(); }
+
+    MappedTable(const MappedTable&) = delete;
+    MappedTable& operator=(const MappedTable&) = delete;
+
+    // Returns false if the file can't be mapped or isn't a valid snapshot.
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return _data != nullptr; }
+
+    std::string format() const;
+    std::string format(ColorPolicy color) const;
+    void print() const;
+
+    friend std::ostream& operator<<(std::ostream& os, const MappedTable& t) {
+        os << t.format();
+        return os;
+    }
+
+    // The options are read from the snapshot, but can be changed before rendering.
+    const TableOptions& options() const { return _options; }
+    void setOptions(const TableOptions& options) { _options = options; }
+    void setColumnVisible(int col, bool visible) { _cols[col].visible = visible; }
+    void setColumnPriority(int col, int priority) { _cols[col].priority = priority; }
+
+    // -- Query -- //
+    int nRows() const { return _nRows; }
+    int nCols() const { return static_cast<int>(_cols.size()); }
+
+private:
+    friend class Renderer;
+    struct Source;
+
+    TableOptions _options;
+    std::vector<Table::Column> _cols;
+    std::vector<char> _decimalCols;     // per column, whether any cell may be decimal aligned
+    int _nRows = 0;
+
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+    const uint8_t* _cells = nullptr;
+    const char* _text = nullptr;
+    uint64_t _textSize = 0;
+    std::vector<Style> _styles;         // the palette, read from the snapshot
+    std::vector<std::string> _styleCodes;
+#ifdef _WIN32
+    void* _file = nullptr;
+    void* _mapping = nullptr;
+#endif
 };
 
 }  // namespace ionic
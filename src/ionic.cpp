@@ -5,27 +5,65 @@
 #include <numeric>
 #include <iostream>
 #include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <thread>
 
 #if defined(_WIN32)
 #	define WIN32_LEAN_AND_MEAN
 #	include <Windows.h>
 #	include <shlobj_core.h>
+#	include <io.h>
 #elif __linux__
 #	include <sys/ioctl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
 #	include <stdio.h>
 #	include <unistd.h>
 #elif __APPLE__
 #    include <sys/ioctl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <fcntl.h>
 #    include <stdio.h>
 #    include <unistd.h>
 #else
 #	error "undefined"
 #endif
 
+#if IONIC_STATS
+#	define IONIC_STAT(x) x
+#else
+#	define IONIC_STAT(x)
+#endif
+
 namespace ionic {															
 
 bool Table::colorEnabled = true;
 
+#if IONIC_STATS
+namespace {
+// Adds the seconds elapsed over its lifetime to the total.
+class StatTimer {
+public:
+	explicit StatTimer(double& total) : _total(total), _start(std::chrono::steady_clock::now()) {}
+	~StatTimer() {
+		_total += std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+	}
+
+private:
+	double& _total;
+	std::chrono::steady_clock::time_point _start;
+};
+} // namespace
+#endif
+
 void Table::initConsole()
 {
 	static std::atomic<bool> init = false;
@@ -109,6 +147,87 @@ std::string colorCode(Color c)
 	return "";
 }
 
+TermColor::TermColor(Color c)
+{
+	if (c != Color::kDefault && c != Color::reset) {
+		kind = Kind::basic;
+		value[0] = uint8_t(c);
+	}
+}
+
+/*static*/ TermColor TermColor::index256(uint8_t index)
+{
+	TermColor tc;
+	tc.kind = Kind::index256;
+	tc.value[0] = index;
+	return tc;
+}
+
+/*static*/ TermColor TermColor::rgb(uint8_t r, uint8_t g, uint8_t b)
+{
+	TermColor tc;
+	tc.kind = Kind::rgb;
+	tc.value[0] = r;
+	tc.value[1] = g;
+	tc.value[2] = b;
+	return tc;
+}
+
+namespace {
+
+// The SGR parameter for a basic foreground color. (Background is +10.)
+int sgrColor(Color c)
+{
+	static const uint8_t kSGR[] = {
+		30, 31, 32, 33, 34, 35, 36,
+		90, 37,
+		91, 92, 93, 94, 95, 96,
+		97,
+	};
+	return size_t(c) < sizeof(kSGR) ? kSGR[size_t(c)] : 39;
+}
+
+void appendColorParams(std::string& s, const TermColor& tc, bool background)
+{
+	if (tc.kind == TermColor::Kind::none)
+		return;
+	if (!s.empty())
+		s += ';';
+	switch (tc.kind) {
+	case TermColor::Kind::basic:
+		s += std::to_string(sgrColor(Color(tc.value[0])) + (background ? 10 : 0));
+		break;
+	case TermColor::Kind::index256:
+		s += background ? "48;5;" : "38;5;";
+		s += std::to_string(tc.value[0]);
+		break;
+	case TermColor::Kind::rgb:
+		s += background ? "48;2;" : "38;2;";
+		s += std::to_string(tc.value[0]) + ';' + std::to_string(tc.value[1]) + ';' + std::to_string(tc.value[2]);
+		break;
+	case TermColor::Kind::none:
+		break;
+	}
+}
+
+} // namespace
+
+std::string styleCode(const Style& style)
+{
+	std::string params;
+	if (style.bold)
+		params += "1";
+	if (style.dim)
+		params += params.empty() ? "2" : ";2";
+	if (style.underline)
+		params += params.empty() ? "4" : ";4";
+	appendColorParams(params, style.fg, false);
+	appendColorParams(params, style.bg, true);
+	if (params.empty())
+		return std::string();
+	return "\x1B[" + params + "m";
+}
+
 std::string colorToStr(Color color)
 {
 	switch (color) {
@@ -181,61 +300,197 @@ Color strToColor(const std::string& _str)
 	return Color::reset;
 }
 
-Table::Dye::Dye(Color c, std::string& s) : _c(c), _s(s)
+int64_t Value::toInt() const
+{
+	switch (_type) {
+	case Type::integer: return _i;
+	case Type::unsignedInteger: return int64_t(_u);
+	case Type::floating: return std::isfinite(_d) ? int64_t(std::llround(_d)) : 0;
+	case Type::text: break;
+	}
+	int64_t v = 0;
+	std::from_chars(_text.data(), _text.data() + _text.size(), v);
+	return v;
+}
+
+double Value::toDouble() const
 {
-	if (_c != Color::kDefault && Table::colorEnabled)
-		_s += colorCode(c);
+	switch (_type) {
+	case Type::integer: return double(_i);
+	case Type::unsignedInteger: return double(_u);
+	case Type::floating: return _d;
+	case Type::text: break;
+	}
+	return std::strtod(std::string(_text).c_str(), nullptr);
 }
 
-Table::Dye::~Dye() {
-	if (_c != Color::kDefault && Table::colorEnabled)
-		_s += colorCode(Color::reset);
+namespace {
+
+constexpr size_t kMaxValueChars = 64;
+
+// Fixed point with the precision, falling back to scientific notation for
+// numbers too large for the buffer.
+char* writeFixed(char* first, char* last, double v, int precision)
+{
+	precision = std::clamp(precision, 0, 17);
+	auto r = std::to_chars(first, last, v, std::chars_format::fixed, precision);
+	if (r.ec != std::errc())
+		r = std::to_chars(first, last, v, std::chars_format::scientific, precision);
+	return r.ec == std::errc() ? r.ptr : first;
 }
 
-void append(std::string& s, char a, char b) 
+char* writeUnit(char* p, char* last, std::string_view unit)
 {
-	s.push_back(a);
-	s.push_back(b);
+	if (size_t(last - p) < unit.size() + 1)
+		return p;
+	*p++ = ' ';
+	memcpy(p, unit.data(), unit.size());
+	return p + unit.size();
 }
 
-void append(std::string& s, char a, char b, char c) 
+// Writes a number into buf (of kMaxValueChars) and returns the text.
+std::string_view formatNumber(char* buf, const Value& v, ValueFormat format, int precision)
 {
-	s.push_back(a);
-	s.push_back(b);
-	s.push_back(c);
+	char* const last = buf + kMaxValueChars;
+	char* p = buf;
+
+	switch (format) {
+	case ValueFormat::automatic:
+	case ValueFormat::integer:
+		// toInt() of an unsigned value round trips through uint64_t.
+		if (v.type() == Value::Type::unsignedInteger)
+			p = std::to_chars(buf, last, uint64_t(v.toInt())).ptr;
+		else if (v.type() == Value::Type::floating && format == ValueFormat::automatic)
+			p = std::to_chars(buf, last, v.toDouble()).ptr;
+		else
+			p = std::to_chars(buf, last, v.toInt()).ptr;
+		break;
+
+	case ValueFormat::floating:
+		p = writeFixed(buf, last, v.toDouble(), precision);
+		break;
+
+	case ValueFormat::bytes: {
+		static constexpr std::string_view kUnits[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB" };
+		double b = v.toDouble();
+		size_t unit = 0;
+		while (std::fabs(b) >= 1024.0 && unit + 1 < std::size(kUnits)) {
+			b /= 1024.0;
+			++unit;
+		}
+		if (unit == 0)
+			p = std::to_chars(buf, last, int64_t(std::llround(b))).ptr;
+		else
+			p = writeFixed(buf, last, b, precision);
+		p = writeUnit(p, last, kUnits[unit]);
+		break;
+	}
+
+	case ValueFormat::duration: {
+		double s = v.toDouble();
+		double a = std::fabs(s);
+		std::string_view unit = "s";
+		if (a == 0.0) {}
+		else if (a < 1e-6) { s *= 1e9; unit = "ns"; }
+		else if (a < 1e-3) { s *= 1e6; unit = "us"; }
+		else if (a < 1.0) { s *= 1e3; unit = "ms"; }
+		else if (a >= 3600.0) { s /= 3600.0; unit = "h"; }
+		else if (a >= 60.0) { s /= 60.0; unit = "min"; }
+		p = writeFixed(buf, last, s, precision);
+		p = writeUnit(p, last, unit);
+		break;
+	}
+	}
+	return std::string_view(buf, size_t(p - buf));
 }
 
-void Table::printLeft(std::string& s) const
+// The width of the line text[start, end) from its decimal point to the end: the
+// first '.', or if there isn't one, the end of the leading number. "12.5 ms" -> 5,
+// "12 ms" -> 3. With escapes, the sequences are skipped and take no width.
+int decimalFrac(std::string_view text, size_t start, size_t end, const Table::Escapes* escapes = nullptr)
 {
-	if (_options.outerBorder) {
-		Dye dye(_options.tableColor, s);
-		append(s, _options.borderVChar, ' ');
+	if (!escapes) {
+		std::string_view line = text.substr(start, end - start);
+		size_t dot = line.find('.');
+		if (dot == std::string_view::npos)
+			dot = std::min(line.find_first_not_of("+-0123456789"), line.size());
+		return int(line.size() - dot);
+	}
+
+	const std::string_view bounded = text.substr(0, end);
+	size_t dot = std::string_view::npos;
+	size_t number = end;
+	for (size_t pos = start; pos < end && dot == std::string_view::npos;) {
+		if (size_t esc = Table::escapeSize(bounded, pos)) {
+			pos += esc;
+			continue;
+		}
+		const char c = text[pos];
+		if (c == '.')
+			dot = pos;
+		else if (number == end && !(c == '+' || c == '-' || (c >= '0' && c <= '9')))
+			number = pos;
+		++pos;
 	}
+	return int(escapes->visibleWidth(dot != std::string_view::npos ? dot : number, end));
+}
+
+// The width of the first line of the text.
+int firstLineWidth(std::string_view text, const Table::Escapes* escapes)
+{
+	const size_t end = std::min(text.find('\n'), text.size());
+	return int(escapes ? escapes->visibleWidth(0, end) : end);
 }
 
-void Table::printRight(std::string& s) const
+// Widest parts of decimal aligned text, before and after the decimal point.
+void measureDecimal(std::string_view text, const Table::Escapes* escapes, int& maxInt, int& maxFrac)
 {
-	if (_options.outerBorder) {
-		Dye dye(_options.tableColor, s);
-		append(s, ' ', _options.borderVChar);
+	size_t pos = 0;
+	while (pos < text.size()) {
+		size_t next = std::min(text.find('\n', pos), text.size());
+		const int width = int(escapes ? escapes->visibleWidth(pos, next) : next - pos);
+		const int frac = decimalFrac(text, pos, next, escapes);
+		maxFrac = std::max(maxFrac, frac);
+		maxInt = std::max(maxInt, width - frac);
+		pos = next + 1;
 	}
 }
 
-void Table::printCenter(std::string& s) const
+// Measures a cell for decimal alignment as it is added, so the layout doesn't
+// need its text. (The measures are kept in 16 bits; no column is that wide.)
+template<class Cell>
+void measureDecimal(Cell& cell, const Table::Escapes* escapes = nullptr)
 {
-	Dye dye(_options.tableColor, s);
-	if (_options.innerVDivider)
-		append(s, ' ', _options.borderVChar, ' ');
-	else
-		append(s, ' ', ' ');
+	int maxInt = 0;
+	int maxFrac = 0;
+	measureDecimal(cell.text, escapes, maxInt, maxFrac);
+	cell.decimalInt = uint16_t(std::min(maxInt, 0xffff));
+	cell.decimalFrac = uint16_t(std::min(maxFrac, 0xffff));
 }
 
+// The number, if the whole text is a finite one. ("inf" and "nan" aren't numbers.)
+bool parseExact(std::string_view text, double& v)
+{
+	if (text.empty())
+		return false;
+	const char* first = text.data();
+	if (*first == '+')
+		++first;
+	auto result = std::from_chars(first, text.data() + text.size(), v);
+	return result.ec == std::errc() && result.ptr == text.data() + text.size() && std::isfinite(v);
+}
+
+} // namespace
+
 void Table::setColumnFormat(const std::vector<Table::Column>& cols)
 {
+	// The kept widths are of the first lines of truncated columns.
+	for (size_t c = 0; c < cols.size() && !_maximaStale; ++c)
+		_maximaStale = (c < _cols.size() && _cols[c].truncate) != cols[c].truncate;
 	_cols = cols;
 }
 
-/*static*/ int Table::nLines(const std::string& s, int& maxWidth)
+/*static*/ int Table::nLines(std::string_view s, int& maxWidth, const Escapes* escapes)
 {
 	int n = 0;
 	maxWidth = 0;
@@ -246,13 +501,84 @@ void Table::setColumnFormat(const std::vector<Table::Column>& cols)
 		next = std::min(next, s.size());
 
 		n++;
-		size_t w = next - pos;
+		size_t w = escapes ? escapes->visibleWidth(pos, next) : next - pos;
 		maxWidth = std::max(maxWidth, (int)w);
 		pos = next + 1;
 	}
 	return n;
 }
 
+Table::Table(const TableOptions& options, std::pmr::memory_resource* resource)
+	: _options(options), _resource(resource), _rows(resource)
+{
+	Style text;
+	text.fg = options.textColor;
+	text.alignment = options.alignment;
+	StyleIndex index;
+	intern(text, index);
+	assert(index == kTextStyle);
+
+	text.alignment = Alignment::decimal;
+	intern(text, _numberStyle);
+}
+
+namespace {
+
+// Packs every field of the style, for the palette lookup.
+uint64_t styleKey(const Style& s)
+{
+	auto color = [](const TermColor& tc) {
+		return uint64_t(tc.kind) << 24 | uint64_t(tc.value[0]) << 16 | uint64_t(tc.value[1]) << 8 | tc.value[2];
+	};
+	return color(s.fg) | color(s.bg) << 26
+		| uint64_t(s.bold) << 52 | uint64_t(s.dim) << 53 | uint64_t(s.underline) << 54
+		| uint64_t(s.alignment) << 55;
+}
+
+} // namespace
+
+bool Table::intern(const Style& style, StyleIndex& index)
+{
+	const uint64_t key = styleKey(style);
+	auto it = _styleIndex.find(key);
+	if (it != _styleIndex.end()) {
+		index = it->second;
+		return true;
+	}
+	if (_styles.size() >= size_t(kMaxStyles))
+		return false;
+	index = StyleIndex(_styles.size());
+	_styles.push_back(style);
+	_styleCodes.push_back(styleCode(style));
+	_styleIndex.emplace(key, index);
+	return true;
+}
+
+void Table::prepareText(std::string_view text, Cell& c) const
+{
+	c.text = text;
+	normalizeNL(c.text);
+	trimRight(c.text);		// right trailing spaces are presumably extraneous
+
+	// Almost all text has no escapes, which a memchr() finds out. The table keeps the
+	// index, so it is found again when the row is added (see encode()).
+	Escapes escapes;
+	const bool hasEscapes = c.text.find('\033') != std::string::npos && findEscapes(c.text, escapes);
+	c.escapes = hasEscapes ? kFindEscapes : -1;
+	c.nLines = nLines(c.text, c.desiredWidth, hasEscapes ? &escapes : nullptr);
+	c.firstWidth = uint16_t(std::min(c.nLines > 1 ? firstLineWidth(c.text, hasEscapes ? &escapes : nullptr) : c.desiredWidth, 0xffff));
+	measureDecimal(c, hasEscapes ? &escapes : nullptr);
+	c.style = kTextStyle;
+}
+
+void Table::prepareRow(const std::vector<std::string>& row, Row& cells) const
+{
+	cells.resize(row.size());
+	for(size_t i=0; i<row.size(); ++i) {
+		prepareText(row[i], cells[i]);
+	}
+}
+
 void Table::addRow(const std::vector<std::string>& row)
 {
 	if (_cols.empty()) {
@@ -262,347 +588,2265 @@ void Table::addRow(const std::vector<std::string>& row)
 	}
 	assert(row.size() == _cols.size());
 	
-	std::vector<Cell> r(row.size());
-	for(size_t i=0; i<row.size(); ++i) {
-		Cell& c = r[i];
-		c.text = row[i];
-		normalizeNL(c.text);
-		trimRight(c.text);		// right trailing spaces are presumably extraneous
-
-		c.nLines = nLines(c.text, c.desiredWidth);
-		c.color = _options.textColor;
-		c.alignment = _options.alignment;
-	}
-	_rows.push_back(r);
+	IONIC_STAT(StatTimer timer(_stats.ingestTime));
+	IONIC_STAT(_stats.rowsAdded++);
+	Row r(_resource);
+	prepareRow(row, r);
+	accumulate(r, _aggregates);
+	addResident(push(std::move(r)));
 }
 
-void Table::setCell(int row, int col, std::optional<Color> color, std::optional<Alignment> alignment)
+void Table::addRow(std::initializer_list<Value> row)
 {
-	Cell& cell = _rows[row][col];
-	if (color) {
-		cell.color = *color;
-	}
-	if (alignment) {
-		cell.alignment = *alignment;
-	}
+	addValues(row.begin(), row.size());
 }
 
-void Table::setRow(int row, std::optional<Color> color, std::optional<Alignment> alignment)
+void Table::addRow(const std::vector<Value>& row)
 {
-	for (size_t c = 0; c < _rows[row].size(); ++c) {
-		setCell(row, int(c), color, alignment);
-	}
+	addValues(row.data(), row.size());
 }
 
-void Table::setColumn(int col, std::optional<Color> color, std::optional<Alignment> alignment)
+template<class F>
+void Table::prepareValues(const Value* values, size_t n, Row& cells, F&& number) const
 {
-	for (size_t r = 0; r < _rows.size(); ++r) {
-		setCell(int(r), col, color, alignment);
+	cells.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		const Value& v = values[i];
+		Cell& c = cells[i];
+		if (v.type() == Value::Type::text) {
+			prepareText(v.text(), c);
+			double d;
+			if (aggregated(i) && parseExact(c.text, d))
+				number(i, d);
+			continue;
+		}
+		if (aggregated(i))
+			number(i, v.toDouble());
+		// Numbers are a single line with nothing to trim. The formatted text
+		// is usually short enough to be stored in the string itself.
+		char buf[kMaxValueChars];
+		c.text.assign(formatNumber(buf, v, _cols[i].format, _cols[i].precision));
+		c.desiredWidth = int(c.text.size());
+		c.firstWidth = uint16_t(c.desiredWidth);
+		c.nLines = 1;
+		measureDecimal(c);
+		c.style = _numberStyle;
 	}
 }
 
-void Table::setTable(std::optional<Color> color, std::optional<Alignment> alignment)
+void Table::addValues(const Value* values, size_t n)
 {
-	for (size_t r = 0; r < _rows.size(); ++r) {
-		setRow(int(r), color, alignment);
+	if (_cols.empty()) {
+		std::vector<Table::Column> cvec;
+		cvec.resize(n, Column{ ColType::flex, 0 });
+		setColumnFormat(cvec);
 	}
+	assert(n == _cols.size());
+
+	IONIC_STAT(StatTimer timer(_stats.ingestTime));
+	IONIC_STAT(_stats.rowsAdded++);
+	Row r(_resource);
+	prepareValues(values, n, r, [this](size_t i, double v) { _aggregates[i].add(v); });
+	addResident(push(std::move(r)));
 }
 
-std::vector<int> Table::computeWidths(const int w) const
+namespace {
+
+// Calls f(first, last) for ranges that split [0, n) over up to nThreads threads
+// (0 for one per core), including this one. Small n just runs here.
+template<class F>
+void parallelFor(size_t n, int nThreads, F&& f)
 {
-	std::vector<int> inner(_cols.size(), 0);
+	constexpr size_t kMinPerThread = 256;
+	size_t threads = nThreads > 0 ? size_t(nThreads) : size_t(std::max(1u, std::thread::hardware_concurrency()));
+	threads = std::min(threads, n / kMinPerThread);
+	if (threads <= 1) {
+		f(size_t(0), n);
+		return;
+	}
 
-	int requiredWidth = 0;
-	int fixedWidth = 0;
-	int nDyn = 0;
+	const size_t chunk = (n + threads - 1) / threads;
+	std::vector<std::thread> workers;
+	workers.reserve(threads - 1);
+	for (size_t t = 1; t < threads; ++t)
+		workers.emplace_back([&f, t, chunk, n]() { f(std::min(n, t * chunk), std::min(n, (t + 1) * chunk)); });
+	f(size_t(0), std::min(n, chunk));
+	for (std::thread& worker : workers)
+		worker.join();
+}
 
-	for (size_t i = 0; i < _cols.size(); ++i) {
-		const Column& c = _cols[i];
-		if (c.type == ColType::fixed) {
-			inner[i] = c.requestedWidth;
-			requiredWidth += c.requestedWidth;
-			fixedWidth += c.requestedWidth;
-		}
-		else {
-			for (size_t j = 0; j < _rows.size(); ++j) {
-				inner[i] = std::max(inner[i], _rows[j][i].desiredWidth);
-			}
-			requiredWidth += kMinWidth;
-			++nDyn;
-		}
-	}
-	if (std::accumulate(inner.begin(), inner.end(), 0) <= w) {
-		return inner; // enough space - no allocation needed
-	}
+} // namespace
 
-	if (requiredWidth >= w) {
-		// Nothing we can do.
-		for (size_t i = 0; i < _cols.size(); ++i) {
-			if (_cols[i].type == ColType::flex) {
-				inner[i] = kMinWidth;
+void Table::addRows(const std::vector<std::vector<std::string>>& rows, int nThreads)
+{
+	if (rows.empty())
+		return;
+	if (_cols.empty())
+		setColumnFormat(std::vector<Column>(rows.front().size(), Column{ ColType::flex, 0 }));
+	IONIC_STAT(StatTimer timer(_stats.ingestTime));
+
+	const size_t nCols = _cols.size();
+	std::vector<Row> cells(rows.size());
+	std::vector<double> numbers(aggregating() ? rows.size() * nCols : 0, std::numeric_limits<double>::quiet_NaN());
+	parallelFor(rows.size(), nThreads, [&](size_t first, size_t last) {
+		for (size_t r = first; r < last; ++r) {
+			assert(rows[r].size() == nCols);
+			prepareRow(rows[r], cells[r]);
+			if (numbers.empty())
+				continue;
+			for (size_t c = 0; c < nCols; ++c) {
+				double& v = numbers[r * nCols + c];
+				if (!aggregated(c) || !parseExact(cells[r][c].text, v))
+					v = std::numeric_limits<double>::quiet_NaN();
 			}
 		}
-		return inner;
-	}
+	});
+	addPrepared(cells, numbers);
+}
 
-	int avail = w - fixedWidth;
-	int grant = avail / nDyn;
+void Table::addRows(const std::vector<std::vector<Value>>& rows, int nThreads)
+{
+	if (rows.empty())
+		return;
+	if (_cols.empty())
+		setColumnFormat(std::vector<Column>(rows.front().size(), Column{ ColType::flex, 0 }));
+	IONIC_STAT(StatTimer timer(_stats.ingestTime));
+
+	const size_t nCols = _cols.size();
+	std::vector<Row> cells(rows.size());
+	std::vector<double> numbers(aggregating() ? rows.size() * nCols : 0, std::numeric_limits<double>::quiet_NaN());
+	parallelFor(rows.size(), nThreads, [&](size_t first, size_t last) {
+		for (size_t r = first; r < last; ++r) {
+			assert(rows[r].size() == nCols);
+			// prepareValues() only calls back for the aggregated columns, so never if numbers is empty.
+			double* rowNumbers = numbers.data() + r * nCols;
+			prepareValues(rows[r].data(), nCols, cells[r], [rowNumbers](size_t i, double v) { rowNumbers[i] = v; });
+		}
+	});
+	addPrepared(cells, numbers);
+}
 
-	std::vector<int> dynCols;
-	for (size_t i = 0; i < _cols.size(); ++i) {
-		if (_cols[i].type == ColType::flex) {
-			if (inner[i] <= grant) {
-				avail -= inner[i];
-			}
-			else {
-				dynCols.push_back((int)i);
-			}
+void Table::addPrepared(std::vector<Row>& rows, const std::vector<double>& numbers)
+{
+	// In row order, so the aggregates, dictionaries and spilling are exactly as from addRow().
+	const size_t nCols = _cols.size();
+	_rows.reserve(_rows.size() + rows.size());
+	for (size_t r = 0; r < rows.size(); ++r) {
+		if (!numbers.empty()) {
+			for (size_t c = 0; c < nCols && c < _aggregates.size(); ++c)
+				_aggregates[c].add(numbers[r * nCols + c]);
 		}
+		addResident(push(std::move(rows[r])));
 	}
+	IONIC_STAT(_stats.rowsAdded += rows.size());
+}
 
-	if (dynCols.empty()) {
-		assert(std::accumulate(inner.begin(), inner.end(), 0) <= w);
-		return inner;
+void Table::Accumulator::add(double v)
+{
+	if (!std::isfinite(v))
+		return;
+	min = count ? std::min(min, v) : v;
+	max = count ? std::max(max, v) : v;
+	sum += v;
+	++count;
+}
+
+void Table::Accumulator::add(const Accumulator& rhs)
+{
+	if (rhs.count == 0)
+		return;
+	min = count ? std::min(min, rhs.min) : rhs.min;
+	max = count ? std::max(max, rhs.max) : rhs.max;
+	sum += rhs.sum;
+	count += rhs.count;
+}
+
+double Table::Accumulator::value(Aggregate aggregate) const
+{
+	switch (aggregate) {
+	case Aggregate::count: return double(count);
+	case Aggregate::sum: return sum;
+	case Aggregate::none: break;
+	case Aggregate::min: if (count) return min; break;
+	case Aggregate::max: if (count) return max; break;
+	case Aggregate::mean: if (count) return sum / double(count); break;
 	}
+	return std::numeric_limits<double>::quiet_NaN();
+}
 
-	assert(dynCols.size());
-	int grant2 = avail / int(dynCols.size());
-	for (size_t i = 0; i < dynCols.size() - 1; ++i) {
-		if (grant2 >= inner[dynCols[i]]) {
-			avail -= inner[dynCols[i]];
-		}
-		else {
-			inner[dynCols[i]] = grant2;
-			avail -= grant2;
+void Table::accumulate(const Row& cells, std::vector<Accumulator>& aggregates) const
+{
+	for (size_t i = 0; i < cells.size() && i < _aggregated.size(); ++i) {
+		double v;
+		if (_aggregated[i] && parseExact(cells[i].text, v)) {
+			if (aggregates.size() <= i)
+				aggregates.resize(_aggregated.size());
+			aggregates[i].add(v);
 		}
 	}
-	inner[dynCols.back()] = avail;
-
-	assert(std::accumulate(inner.begin(), inner.end(), 0) == w);
-	return inner;
 }
 
-/*static*/ Table::Break Table::lineBreak(const std::string& text, size_t start, size_t end, int p_width)
+double Table::aggregate(int col, Aggregate aggregate) const
 {
-	// Don't think about newlines - they are handled by the caller.
-	// (But do check we were called correctly.)
-	assert(text.size() == end || text[end] == '\n');
-	assert(p_width > 0);
-	const size_t width = (size_t)p_width;
-
-	size_t pos = start;
-	size_t nextSpace = start;
-	size_t prevSpace = start;
-	size_t next = start;
-	size_t prev = start;
-
-	while (next < end) {
-		nextSpace = text.find_first_of(kSpace, pos);
-		nextSpace = std::min(nextSpace, end);
-		next = text.find_first_not_of(kSpace, nextSpace + 1);
-		next = std::min(next, end);
+	if (size_t(col) < _aggregates.size())
+		return _aggregates[col].value(aggregate);
+	return Accumulator().value(aggregate);
+}
 
-		assert(nextSpace == end || nextSpace < next);
+/*static*/ std::string Table::formatValue(const Value& value, ValueFormat format, int precision)
+{
+	if (value.type() == Value::Type::text)
+		return std::string(value.text());
+	char buf[kMaxValueChars];
+	return std::string(formatNumber(buf, value, format, precision));
+}
 
-		if (nextSpace - start > width) {
-			if (prev == start) {
-				return Break{ start, nextSpace, next };	// truncate words greater than column width
-			}
-			else {
-				return Break{ start, prevSpace, prev };
-			}
-		}
-		pos = next;
-		prev = next;
-		prevSpace = nextSpace;
+Table::Rows& Table::Rows::operator=(const Rows& rhs)
+{
+	if (this != &rhs) {
+		// Neither side may change a segment in place from now on.
+		for (Ref& ref : rhs._segments)
+			ref.shared = true;
+		_segments = rhs._segments;
+		_resource = rhs._resource;
+		_first = rhs._first;
+		_size = rhs._size;
 	}
-	return Break{ start, nextSpace, next };
+	return *this;
 }
 
-/*static*/ std::vector<Table::Break> Table::wordWrap(const std::string& text, int width)
+Table::Rows::Segment& Table::Rows::own(Ref& ref)
 {
-	if (width == 0)
-		width = consoleWidth();
-
-	std::vector<Break> lines;
-	size_t start = 0;
+	if (ref.shared) {
+		ref.segment = std::allocate_shared<Segment>(std::pmr::polymorphic_allocator<Segment>(_resource), *ref.segment, _resource);
+		ref.shared = false;
+	}
+	return *ref.segment;
+}
 
-	while (start < text.size()) {
-		// Newlines are hard breaks.
-		size_t end = text.find('\n', start);
-		end = std::min(end, text.size());
+Table::Row& Table::Rows::edit(size_t r)
+{
+	assert(r < _size);
+	r += _first;
+	return own(_segments[r / kSegmentRows]).rows[r % kSegmentRows];
+}
 
-		// Hit a new line.
-		if (end == start) {
-			lines.push_back(Break{ start, start, start + 1});
-			start = end + 1;
-			continue;
+void Table::Rows::push_back(Row&& row)
+{
+	if ((_first + _size) % kSegmentRows == 0)
+		_segments.push_back(Ref{ std::allocate_shared<Segment>(std::pmr::polymorphic_allocator<Segment>(_resource), _resource) });
+	Segment& segment = own(_segments.back());
+	segment.rows.push_back(std::move(row));
+	++_size;
+	// The index is kept with the row, so it is shared and dropped with the segment.
+	for (Cell& cell : segment.rows.back()) {
+		if (cell.escapes == kFindEscapes) {
+			cell.escapes = int(segment.escapes.size());
+			segment.escapes.emplace_back();
+			findEscapes(cell.text, segment.escapes.back());
 		}
+	}
+}
 
-		Break bk = lineBreak(text, start, end, width);
-		if (bk.next < text.size() && text[bk.next] == '\n') {
-			bk.next++;
-		}
-		lines.push_back(bk);
+void Table::Rows::pop_front()
+{
+	assert(_size > 0);
+	--_size;
+	if (++_first == kSegmentRows || _size == 0) {
+		_segments.erase(_segments.begin());
+		_first = 0;
+	}
+}
 
-		start = bk.next;
+size_t Table::Rows::bytes() const
+{
+	size_t n = _segments.capacity() * sizeof(Ref);
+	for (const Ref& ref : _segments) {
+		n += sizeof(Segment) + ref.segment->rows.capacity() * sizeof(Row) + ref.segment->escapes.capacity() * sizeof(Escapes);
+		for (const auto& row : ref.segment->rows)
+			n += row.capacity() * sizeof(Cell);
 	}
-	return lines;
+	return n;
 }
 
-void Table::print() const
+Table::Pending::Pending(const Pending& rhs)
 {
-	initConsole();
-	std::cout << format();
+	std::lock_guard<std::mutex> lock(rhs.mutex);
+	batches = rhs.batches;
+	aggregates = rhs.aggregates;
+	ingestTime = rhs.ingestTime;
 }
 
-std::string Table::format() const
+Table::Pending& Table::Pending::operator=(const Pending& rhs)
 {
-	std::string out;
-	if (_cols.empty() || _rows.empty()) {
-		return out;
+	if (this != &rhs) {
+		std::scoped_lock lock(mutex, rhs.mutex);
+		batches = rhs.batches;
+		aggregates = rhs.aggregates;
+		ingestTime = rhs.ingestTime;
 	}
+	return *this;
+}
 
-	int vDivWidth = _options.innerVDivider ? 3 : 2;
-
-	int outerWidth = _options.maxWidth > 0 ? _options.maxWidth : consoleWidth();
-	int innerWidth = outerWidth - _options.indent;
-	if (_options.outerBorder)
-		innerWidth -= 2 * 2;	// 2 for each border
-	innerWidth -= vDivWidth * (int(_cols.size()) - 1);	// 3 for each inner border
+void Table::Appender::addRow(const std::vector<std::string>& row)
+{
+	// Only reads the table options and footer definitions, which don't change while
+	// Appenders are active, so this is safe on any thread.
+	assert(_rows.empty() || row.size() == _rows.front().size());
+	{
+		IONIC_STAT(StatTimer timer(_ingestTime));
+		_rows.emplace_back();
+		_table.prepareRow(row, _rows.back());
+		_table.accumulate(_rows.back(), _aggregates);
+	}
+	if (_rows.size() >= _batchRows)
+		flush();
+}
 
-	std::vector<int> innerColWidth = computeWidths(innerWidth);
-	
-	/*
-		Fixed(1), Dynamic, Wrap
-		Inner
-		  1   5       15
-		+---+-------+-----------------+
-	    | 0 | A     | The Outer World |
-		+---+-------+-----------------+
-		| 1 | Hello | And Another     |
-		+---+-------+-----------------+ extra y
-	
-	*/
+void Table::Appender::flush()
+{
+	if (_rows.empty())
+		return;
 
-	out.reserve(outerWidth * _rows.size() * 2);	// rough guess
+	std::lock_guard<std::mutex> lock(_table._pending.mutex);
+	// The column format is set here, under the lock, rather than lazily by the producers.
+	if (_table._cols.empty())
+		_table._cols.resize(_rows.front().size(), Column{ ColType::flex, 0 });
+	assert(_rows.front().size() == _table._cols.size());
+	_table._pending.batches.push_back(std::move(_rows));
+	std::vector<Accumulator>& aggregates = _table._pending.aggregates;
+	if (aggregates.size() < _aggregates.size())
+		aggregates.resize(_aggregates.size());
+	for (size_t i = 0; i < _aggregates.size(); ++i)
+		aggregates[i].add(_aggregates[i]);
+	_table._pending.ingestTime += _ingestTime;
+	_rows.clear();
+	_aggregates.clear();
+	_ingestTime = 0;
+}
 
-	printHorizontalBorder(out, innerColWidth, true);
+void Table::merge()
+{
+	std::vector<std::vector<Row>> batches;
+	std::vector<Accumulator> aggregates;
+	{
+		std::lock_guard<std::mutex> lock(_pending.mutex);
+		batches.swap(_pending.batches);
+		aggregates.swap(_pending.aggregates);
+		IONIC_STAT(_stats.ingestTime += _pending.ingestTime);
+		_pending.ingestTime = 0;
+	}
 
-	for (size_t r = 0; r < _rows.size(); ++r) {
-		std::vector<std::vector<Break>> breaks;
-		breaks.resize(_cols.size());
-		for (size_t c = 0; c < _cols.size(); ++c) {
-			const std::string& s = _rows[r][c].text;
-			breaks[c] = wordWrap(s, innerColWidth[c]);
+	if (_aggregates.size() < aggregates.size())
+		_aggregates.resize(aggregates.size());
+	for (size_t i = 0; i < aggregates.size(); ++i)
+		_aggregates[i].add(aggregates[i]);
+
+	size_t n = _rows.size();
+	for (const auto& batch : batches)
+		n += batch.size();
+	_rows.reserve(n);
+
+	size_t bytes = 0;
+	for (auto& batch : batches) {
+		for (auto& row : batch) {
+			// Producers don't touch the dictionaries; the values are looked up here.
+			bytes += push(std::move(row));
 		}
+		IONIC_STAT(_stats.rowsAdded += batch.size());
+	}
+	addResident(bytes);
+}
+
+std::shared_ptr<const Table> Table::snapshot() const
+{
+	// Member by member, to leave out the pending batches; only the rows are shared.
+	auto snap = std::allocate_shared<Table>(std::pmr::polymorphic_allocator<Table>(_resource), _options, _resource);
+	snap->_cols = _cols;
+	snap->_rows = _rows;
+	snap->_styles = _styles;
+	snap->_styleCodes = _styleCodes;
+	snap->_styleIndex = _styleIndex;
+	snap->_numberStyle = _numberStyle;
+	snap->_aggregates = _aggregates;
+	snap->_aggregated = _aggregated;
+	snap->_footers = _footers;
+	snap->_dictionaries = _dictionaries;
+	snap->_spill = _spill;
+	snap->_segments = _segments;
+	snap->_spilledRows = _spilledRows;
+	snap->_residentBytes = _residentBytes;
+	// The maxima aren't copied: the snapshot's layout measures its rows (at most maxRows),
+	// as it renders them anyway.
+	snap->_dropped = _dropped;
+	snap->_maximaStale = true;
+	snap->_decimalCols = _decimalCols;
+	return snap;
+}
+
+void Table::setCell(int row, int col, std::optional<Color> color, std::optional<Alignment> alignment)
+{
+	Cell& cell = _rows.edit(row)[col];
+	Style style = _styles[cell.style];
+	if (color) {
+		style.fg = *color;
+	}
+	if (alignment) {
+		style.alignment = *alignment;
+	}
+	StyleIndex index;
+	if (intern(style, index))
+		restyle(cell, size_t(col), index);
+}
+
+void Table::setRow(int row, std::optional<Color> color, std::optional<Alignment> alignment)
+{
+	for (size_t c = 0; c < _rows[row].size(); ++c) {
+		setCell(row, int(c), color, alignment);
+	}
+}
+
+void Table::setColumn(int col, std::optional<Color> color, std::optional<Alignment> alignment)
+{
+	for (size_t r = 0; r < _rows.size(); ++r) {
+		setCell(int(r), col, color, alignment);
+	}
+}
+
+void Table::setTable(std::optional<Color> color, std::optional<Alignment> alignment)
+{
+	for (size_t r = 0; r < _rows.size(); ++r) {
+		setRow(int(r), color, alignment);
+	}
+}
+
+void Table::setCell(int row, int col, const Style& style)
+{
+	StyleIndex index;
+	if (intern(style, index))
+		restyle(_rows.edit(row)[col], size_t(col), index);
+}
+
+void Table::setRow(int row, const Style& style)
+{
+	StyleIndex index;
+	if (!intern(style, index))
+		return;
+	Row& cells = _rows.edit(row);
+	for (size_t c = 0; c < cells.size(); ++c)
+		restyle(cells[c], c, index);
+}
+
+void Table::setColumn(int col, const Style& style)
+{
+	StyleIndex index;
+	if (!intern(style, index))
+		return;
+	for (size_t r = 0; r < _rows.size(); ++r)
+		restyle(_rows.edit(r)[col], size_t(col), index);
+}
+
+void Table::setTable(const Style& style)
+{
+	StyleIndex index;
+	if (!intern(style, index))
+		return;
+	for (size_t r = 0; r < _rows.size(); ++r) {
+		Row& cells = _rows.edit(r);
+		for (size_t c = 0; c < cells.size(); ++c)
+			restyle(cells[c], c, index);
+	}
+}
+
+/*static*/ size_t Table::escapeSize(std::string_view text, size_t pos)
+{
+	if (pos >= text.size() || text[pos] != '\033')
+		return 0;
+	if (pos + 1 >= text.size())
+		return 1;
+	if (text[pos + 1] != '[')
+		return 2;
+	// CSI: parameter and intermediate bytes, up to a final byte in 0x40-0x7e.
+	for (size_t i = pos + 2; i < text.size(); ++i) {
+		const unsigned char ch = (unsigned char)text[i];
+		if (ch >= 0x40 && ch <= 0x7e)
+			return i + 1 - pos;
+		if (ch < 0x20 || ch > 0x3f)
+			return i - pos;		// not a valid sequence; it ends here
+	}
+	return text.size() - pos;
+}
+
+/*static*/ bool Table::findEscapes(std::string_view text, Escapes& escapes)
+{
+	escapes.escapes.clear();
+	uint32_t before = 0;
+	for (size_t pos = text.find('\033'); pos != std::string_view::npos; pos = text.find('\033', pos)) {
+		const size_t size = escapeSize(text, pos);
+		escapes.escapes.push_back(Escape{ uint32_t(pos), uint32_t(size), before });
+		before += uint32_t(size);
+		pos += size;
+	}
+	return !escapes.escapes.empty();
+}
+
+size_t Table::Escapes::visibleWidth(size_t start, size_t end) const
+{
+	auto bytesBefore = [this](size_t pos) -> size_t {
+		auto it = std::lower_bound(escapes.begin(), escapes.end(), pos,
+			[](const Escape& e, size_t p) { return e.pos < p; });
+		if (it == escapes.end())
+			return escapes.empty() ? 0 : escapes.back().before + escapes.back().size;
+		return it->before;
+	};
+	return (end - start) - (bytesBefore(end) - bytesBefore(start));
+}
+
+/*static*/ Table::Break Table::lineBreak(std::string_view text, size_t start, size_t end, int p_width, const Escapes* escapes)
+{
+	// Don't think about newlines - they are handled by the caller.
+	// (But do check we were called correctly.)
+	assert(text.size() == end || text[end] == '\n');
+	assert(p_width > 0);
+	const size_t width = (size_t)p_width;
+
+	size_t pos = start;
+	size_t nextSpace = start;
+	size_t prevSpace = start;
+	size_t next = start;
+	size_t prev = start;
+
+	while (next < end) {
+		nextSpace = text.find_first_of(kSpace, pos);
+		nextSpace = std::min(nextSpace, end);
+		next = text.find_first_not_of(kSpace, nextSpace + 1);
+		next = std::min(next, end);
+
+		assert(nextSpace == end || nextSpace < next);
+
+		const size_t w = escapes ? escapes->visibleWidth(start, nextSpace) : nextSpace - start;
+		if (w > width) {
+			if (prev == start) {
+				return Break{ start, nextSpace, next };	// truncate words greater than column width
+			}
+			else {
+				return Break{ start, prevSpace, prev };
+			}
+		}
+		pos = next;
+		prev = next;
+		prevSpace = nextSpace;
+	}
+	return Break{ start, nextSpace, next };
+}
+
+/*static*/ std::vector<Table::Break> Table::wordWrap(std::string_view text, int width)
+{
+	std::vector<Break> lines;
+	wordWrap(text, width, lines);
+	return lines;
+}
+
+/*static*/ void Table::wordWrap(std::string_view text, int width, std::vector<Break>& lines, const Escapes* escapes)
+{
+	if (width == 0)
+		width = consoleWidth();
+
+	lines.clear();
+	size_t start = 0;
+
+	while (start < text.size()) {
+		// Newlines are hard breaks.
+		size_t end = text.find('\n', start);
+		end = std::min(end, text.size());
+
+		// Hit a new line.
+		if (end == start) {
+			lines.push_back(Break{ start, start, start + 1});
+			start = end + 1;
+			continue;
+		}
+
+		Break bk = lineBreak(text, start, end, width, escapes);
+		if (bk.next < text.size() && text[bk.next] == '\n') {
+			bk.next++;
+		}
+		lines.push_back(bk);
+
+		start = bk.next;
+	}
+}
+
+namespace {
+
+// What the layout and render code needs from a cell, independent of where
+// the cell is stored. (A Table keeps its cells in memory, a MappedTable
+// reads them from the mapped file.)
+struct CellRef {
+	std::string_view text;
+	int desiredWidth = 0;
+	int nLines = 0;
+	std::string_view code;		// the style's escape, or empty for none
+	Alignment alignment = Alignment::left;
+	int value = -1;				// the index in the column's dictionary, if it has one
+	const Table::Escapes* escapes = nullptr;	// if the text has escape sequences
+};
+
+// What the layout needs from a cell. The text isn't included, so a source with its
+// text on disk (or in a mapped file) doesn't read it to lay out the columns.
+struct CellMeasure {
+	int desiredWidth = 0;
+	Alignment alignment = Alignment::left;
+	int decimalInt = 0;		// the widest parts of the lines before and from the decimal point
+	int decimalFrac = 0;
+	int firstWidth = 0;		// the width of the first line, for truncated columns
+};
+
+// The measures of a cell whose text is at hand.
+CellMeasure measureRef(const CellRef& cell)
+{
+	CellMeasure m{ cell.desiredWidth, cell.alignment };
+	m.firstWidth = cell.nLines > 1 ? firstLineWidth(cell.text, cell.escapes) : cell.desiredWidth;
+	if (cell.alignment == Alignment::decimal)
+		measureDecimal(cell.text, cell.escapes, m.decimalInt, m.decimalFrac);
+	return m;
+}
+
+// Wraps the text appended during its lifetime in the color, if color is used.
+struct Dye {
+	Dye(Color c, bool enabled, std::string& s) : _on(enabled && c != Color::kDefault), _s(s) {
+		if (_on)
+			_s += colorCode(c);
+	}
+	~Dye() {
+		if (_on)
+			_s += colorCode(Color::reset);
+	}
+
+private:
+	bool _on;
+	std::string& _s;
+};
+
+constexpr std::string_view kResetCode = "\033[0m";
+
+// Bytes of escape codes in s. Only used for stats.
+[[maybe_unused]] uint64_t countEscapeBytes(const std::string& s)
+{
+	uint64_t n = 0;
+	for (size_t pos = s.find('\x1B'); pos != std::string::npos; pos = s.find('\x1B', pos)) {
+		size_t end = std::min(s.find('m', pos), s.size() - 1) + 1;
+		n += end - pos;
+		pos = end;
+	}
+	return n;
+}
+
+void append(std::string& s, char a, char b)
+{
+	s.push_back(a);
+	s.push_back(b);
+}
+
+// The glyphs of a horizontal line: its ends, the line, and where it meets a column
+// divider. Each is a single character on screen, but may be several bytes.
+struct LineGlyphs {
+	std::string_view left;
+	std::string_view h;
+	std::string_view junction;
+	std::string_view right;
+};
+
+struct BorderGlyphs {
+	LineGlyphs top;
+	LineGlyphs inner;
+	LineGlyphs footer;
+	LineGlyphs bottom;
+	std::string_view v;
+};
+
+// The Unicode styles, in BorderStyle order from light; UTF-8, written as escapes.
+const BorderGlyphs kBoxGlyphs[] = {
+	{	// light: thin lines, with a double line above the footer
+		{ "\xe2\x94\x8c", "\xe2\x94\x80", "\xe2\x94\xac", "\xe2\x94\x90" },
+		{ "\xe2\x94\x9c", "\xe2\x94\x80", "\xe2\x94\xbc", "\xe2\x94\xa4" },
+		{ "\xe2\x95\x9e", "\xe2\x95\x90", "\xe2\x95\xaa", "\xe2\x95\xa1" },
+		{ "\xe2\x94\x94", "\xe2\x94\x80", "\xe2\x94\xb4", "\xe2\x94\x98" },
+		"\xe2\x94\x82",
+	},
+	{	// heavy: thick lines, with a thin line above the footer
+		{ "\xe2\x94\x8f", "\xe2\x94\x81", "\xe2\x94\xb3", "\xe2\x94\x93" },
+		{ "\xe2\x94\xa3", "\xe2\x94\x81", "\xe2\x95\x8b", "\xe2\x94\xab" },
+		{ "\xe2\x94\xa0", "\xe2\x94\x80", "\xe2\x95\x82", "\xe2\x94\xa8" },
+		{ "\xe2\x94\x97", "\xe2\x94\x81", "\xe2\x94\xbb", "\xe2\x94\x9b" },
+		"\xe2\x94\x83",
+	},
+	{	// doubleLine: double lines, with a single line above the footer
+		{ "\xe2\x95\x94", "\xe2\x95\x90", "\xe2\x95\xa6", "\xe2\x95\x97" },
+		{ "\xe2\x95\xa0", "\xe2\x95\x90", "\xe2\x95\xac", "\xe2\x95\xa3" },
+		{ "\xe2\x95\x9f", "\xe2\x94\x80", "\xe2\x95\xab", "\xe2\x95\xa2" },
+		{ "\xe2\x95\x9a", "\xe2\x95\x90", "\xe2\x95\xa9", "\xe2\x95\x9d" },
+		"\xe2\x95\x91",
+	},
+	{	// rounded: light, with rounded outer corners
+		{ "\xe2\x95\xad", "\xe2\x94\x80", "\xe2\x94\xac", "\xe2\x95\xae" },
+		{ "\xe2\x94\x9c", "\xe2\x94\x80", "\xe2\x94\xbc", "\xe2\x94\xa4" },
+		{ "\xe2\x95\x9e", "\xe2\x95\x90", "\xe2\x95\xaa", "\xe2\x95\xa1" },
+		{ "\xe2\x95\xb0", "\xe2\x94\x80", "\xe2\x94\xb4", "\xe2\x95\xaf" },
+		"\xe2\x94\x82",
+	},
+};
+
+// The glyphs of the options' BorderStyle. For ascii, they point into the options.
+BorderGlyphs borderGlyphs(const TableOptions& options)
+{
+	if (options.borderStyle != BorderStyle::ascii) {
+		const size_t i = size_t(options.borderStyle) - size_t(BorderStyle::light);
+		assert(i < sizeof(kBoxGlyphs) / sizeof(kBoxGlyphs[0]));
+		return kBoxGlyphs[i];
+	}
+	const std::string_view corner(&options.borderCornerChar, 1);
+	const std::string_view h(&options.borderHChar, 1);
+	const LineGlyphs line{ corner, h, corner, corner };
+	return BorderGlyphs{ line, line, LineGlyphs{ corner, std::string_view(&options.footerHChar, 1), corner, corner },
+		line, std::string_view(&options.borderVChar, 1) };
+}
+
+void appendGlyph(std::string& s, std::string_view glyph, size_t n)
+{
+	if (glyph.size() == 1) {
+		s.append(n, glyph[0]);
+		return;
+	}
+	for (size_t i = 0; i < n; ++i)
+		s += glyph;
+}
+
+// The parts of the table around the cell text, which are the same for every
+// line of a render, so they are built once per format(). Drawing a border line
+// is then one append, whatever the glyphs.
+struct Frame {
+	std::string topLine;	// top border line, empty if there isn't an outer border
+	std::string bottomLine;	// bottom border line, likewise
+	std::string innerLine;	// line between rows, empty if there isn't one
+	std::string footerLine;	// line above the footer rows, empty if there aren't any
+	std::string left;		// start of each line of text, including the indent
+	std::string center;		// between columns
+	std::string right;		// end of each line of text, including the newline
+};
+
+void horizontalBorder(const TableOptions& options, bool color, const std::vector<int>& innerColWidth, const LineGlyphs& g, std::string& buf)
+{
+	buf.clear();
+	buf.append(options.indent, ' ');
+	{
+		Dye dye(options.tableColor, color, buf);
+		if (options.outerBorder) {
+			for (size_t c = 0; c < innerColWidth.size(); ++c) {
+				if (c == 0)
+					buf += g.left;
+				else if (options.innerVDivider)
+					buf += g.junction;
+				appendGlyph(buf, g.h, size_t(2 + innerColWidth[c]));
+			}
+			buf += g.right;
+		}
+		else {
+			appendGlyph(buf, g.h, size_t(1 + innerColWidth[0]));
+			for (size_t c = 1; c < innerColWidth.size(); ++c) {
+				// Without vertical dividers, ascii still marks the column; the box styles don't.
+				buf += options.innerVDivider || options.borderStyle == BorderStyle::ascii ? g.junction : g.h;
+				appendGlyph(buf, g.h, size_t(2 + innerColWidth[c]));
+			}
+		}
+	}
+	buf.push_back('\n');
+}
+
+// The strings are reused, so a Renderer doesn't allocate for them once they are big enough.
+void buildFrame(const TableOptions& options, bool color, const std::vector<int>& innerColWidth, bool footer, Frame& f)
+{
+	f.topLine.clear();
+	f.bottomLine.clear();
+	f.innerLine.clear();
+	f.footerLine.clear();
+	f.left.clear();
+	f.center.clear();
+	f.right.clear();
+
+	const BorderGlyphs glyphs = borderGlyphs(options);
+	if (options.outerBorder) {
+		horizontalBorder(options, color, innerColWidth, glyphs.top, f.topLine);
+		horizontalBorder(options, color, innerColWidth, glyphs.bottom, f.bottomLine);
+	}
+	if (options.innerHDivider)
+		horizontalBorder(options, color, innerColWidth, glyphs.inner, f.innerLine);
+	if (footer)
+		horizontalBorder(options, color, innerColWidth, glyphs.footer, f.footerLine);
+
+	f.left.append(options.indent, ' ');
+	if (options.outerBorder) {
+		{
+			Dye dye(options.tableColor, color, f.left);
+			f.left += glyphs.v;
+			f.left += ' ';
+		}
+		{
+			Dye dye(options.tableColor, color, f.right);
+			f.right += ' ';
+			f.right += glyphs.v;
+		}
+	}
+	f.right.push_back('\n');
+	{
+		Dye dye(options.tableColor, color, f.center);
+		if (options.innerVDivider) {
+			f.center += ' ';
+			f.center += glyphs.v;
+			f.center += ' ';
+		}
+		else {
+			append(f.center, ' ', ' ');
+		}
+	}
+}
+
+// Calls f(row) for each row used to lay out the table: all of them, or with
+// widthSampleRows, a stratified sample. The rows are split into equal strata
+// and one row is picked from each. The pick within the stratum is a fixed hash,
+// so the layout is stable between renders.
+template<class F>
+void forLayoutRows(const TableOptions& options, int nRows, F&& f)
+{
+	if (options.widthSampleRows <= 0) {
+		for (int r = 0; r < nRows; ++r)
+			f(r);
+		return;
+	}
+
+	const int nSample = std::min(nRows, options.widthSampleRows);
+	const double stride = double(nRows) / nSample;
+	for (int i = 0; i < nSample; ++i) {
+		int first = int(i * stride);
+		int size = std::max(1, int((i + 1) * stride) - first);
+		uint32_t h = uint32_t(i + 1) * 2654435761u;
+		f(std::min(nRows - 1, first + int(h % uint32_t(size))));
+	}
+}
+
+// The widest cell of a column, and the widest parts of its decimal aligned cells.
+struct ColumnMeasure {
+	int width = 0;
+	int maxInt = 0;
+	int maxFrac = 0;
+};
+
+// Whether a source keeps the measures of its columns, with maxima(columns, measures).
+template<class S, class = void>
+struct KeepsMaxima : std::false_type {};
+template<class S>
+struct KeepsMaxima<S, std::void_t<decltype(&S::maxima)>> : std::true_type {};
+
+// Sets inner to the column sizes for the given width. fracWidth is set to the width
+// needed after the decimal point in each column, for decimal aligned cells. If
+// measured is set, the rows of src are measured on top of it. The vectors (and the
+// sample scratch space) are reused between renders.
+template<class Source>
+void computeWidths(const TableOptions& options, const std::vector<Table::Column>& cols, const Source& src, const int w,
+	std::vector<int>& inner, std::vector<int>& fracWidth, std::vector<int>& sample, const ColumnMeasure* measured = nullptr)
+{
+	inner.assign(cols.size(), 0);
+	const bool sampled = options.widthSampleRows > 0;
+	fracWidth.assign(cols.size(), 0);
+
+	int requiredWidth = 0;
+	int fixedWidth = 0;
+	int nDyn = 0;
+
+	for (size_t i = 0; i < cols.size(); ++i) {
+		const Table::Column& c = cols[i];
+		const bool flex = c.type == ColType::flex;
+		int maxInt = 0;
+		if (measured) {
+			inner[i] = measured[i].width;
+			maxInt = measured[i].maxInt;
+			fracWidth[i] = measured[i].maxFrac;
+		}
+
+		sample.clear();
+		// A fixed column's cells are only needed for decimal alignment. Only the
+		// measures are read, never the text.
+		if (flex || src.decimal(int(i))) {
+			forLayoutRows(options, src.nRows(), [&](int r) {
+				const CellMeasure cell = src.measure(r, int(i));
+				if (flex) {
+					// A truncated column only shows the first line.
+					const int width = c.truncate ? cell.firstWidth : cell.desiredWidth;
+					if (sampled)
+						sample.push_back(width);
+					else
+						inner[i] = std::max(inner[i], width);
+				}
+				if (cell.alignment == Alignment::decimal) {
+					maxInt = std::max(maxInt, cell.decimalInt);
+					fracWidth[i] = std::max(fracWidth[i], cell.decimalFrac);
+				}
+			});
+		}
+
+		if (c.type == ColType::fixed) {
+			inner[i] = c.requestedWidth;
+			requiredWidth += c.requestedWidth;
+			fixedWidth += c.requestedWidth;
+		}
+		else {
+			if (sampled && !sample.empty()) {
+				// The quantile of the sampled widths; below 1 drops the widest outliers.
+				double q = std::clamp(options.widthSampleQuantile, 0.0, 1.0);
+				size_t k = std::min(sample.size() - 1, size_t(q * (sample.size() - 1) + 0.5));
+				std::nth_element(sample.begin(), sample.begin() + k, sample.end());
+				inner[i] = sample[k];
+			}
+			inner[i] = std::max(inner[i], maxInt + fracWidth[i]);
+			requiredWidth += Table::kMinWidth;
+			++nDyn;
+		}
+	}
+	if (std::accumulate(inner.begin(), inner.end(), 0) <= w) {
+		return; // enough space - no allocation needed
+	}
+
+	if (requiredWidth >= w) {
+		// Nothing we can do.
+		for (size_t i = 0; i < cols.size(); ++i) {
+			if (cols[i].type == ColType::flex) {
+				inner[i] = Table::kMinWidth;
+			}
+		}
+		return;
+	}
+
+	int avail = w - fixedWidth;
+	int grant = avail / nDyn;
+
+	std::vector<int>& dynCols = sample;	// done with the sample
+	dynCols.clear();
+	for (size_t i = 0; i < cols.size(); ++i) {
+		if (cols[i].type == ColType::flex) {
+			if (inner[i] <= grant) {
+				avail -= inner[i];
+			}
+			else {
+				dynCols.push_back((int)i);
+			}
+		}
+	}
+
+	if (dynCols.empty()) {
+		assert(std::accumulate(inner.begin(), inner.end(), 0) <= w);
+		return;
+	}
+
+	assert(dynCols.size());
+	int grant2 = avail / int(dynCols.size());
+	for (size_t i = 0; i < dynCols.size() - 1; ++i) {
+		if (grant2 >= inner[dynCols[i]]) {
+			avail -= inner[dynCols[i]];
+		}
+		else {
+			inner[dynCols[i]] = grant2;
+			avail -= grant2;
+		}
+	}
+	inner[dynCols.back()] = avail;
+
+	assert(std::accumulate(inner.begin(), inner.end(), 0) == w);
+}
+
+// The text of one spilled segment, read back for a render. The segment is
+// identified by its file and offset.
+struct SpillCache {
+	uint64_t file = 0;
+	uint64_t offset = 0;
+	bool loaded = false;
+	std::vector<char> data;
+	std::vector<std::string_view> cells;	// into data, row major
+
+	// For a view: the spilled text of its rows, read in table order before the render
+	// (see TableView::render()), by view row and column.
+	std::string viewData;
+	std::vector<std::string_view> viewCells;
+};
+
+} // namespace
+
+// Everything a render needs besides the table, kept by a Renderer between renders.
+struct Renderer::Scratch {
+	std::string out;
+	Frame frame;
+	std::vector<int> innerColWidth;
+	std::vector<int> fracWidth;
+	std::vector<int> sample;
+	std::vector<int> columns;				// the columns rendered, by index in the table
+	std::vector<Table::Column> visibleCols;
+	std::vector<CellRef> row;
+	std::vector<std::vector<Table::Break>> breaks;
+	std::vector<const std::vector<Table::Break>*> lines;	// each cell's lines: breaks, or from the dictionary cache
+	// Per column, the lines of each dictionary value, wrapped the first time it is emitted.
+	std::vector<std::vector<std::vector<Table::Break>>> valueLines;
+	std::vector<std::vector<char>> valueWrapped;
+	std::vector<ColumnMeasure> measures;	// kept by the table, with maxRows
+	std::string lead;						// escape sequences carried onto a wrapped line
+	std::vector<CellRef> footer;			// footer rows, row major
+	std::vector<std::string> footerText;
+	std::vector<Table::Escapes> footerEscapes;	// of the labels, which may be colorized
+	SpillCache spill;
+	std::vector<Table::Escapes> escapes;	// per column, of a mapped cell with escape sequences
+};
+
+namespace {
+
+// The bytes of text that hold its first n visible characters, with the escape
+// sequences among them.
+size_t visiblePrefix(std::string_view text, size_t n)
+{
+	size_t pos = 0;
+	while (pos < text.size()) {
+		if (size_t esc = Table::escapeSize(text, pos)) {
+			pos += esc;
+			continue;
+		}
+		if (n == 0)
+			break;
+		--n;
+		++pos;
+	}
+	return pos;
+}
+
+// Appends one line of a cell, aligned in (or truncated to) the width. visible is
+// the width of the line on screen, which is less than its size if it has escape
+// sequences, and lead is the sequences from the cell's earlier lines. code is the
+// style escape, or empty for the default style. For decimal alignment, fracWidth is
+// the column's width from the decimal point, and frac the line's.
+template<bool kColor>
+void emitCellLine(std::string& out, std::string_view view, size_t visible, std::string_view lead, size_t width, Alignment align, int fracWidth, int frac, std::string_view code, TableStats& local)
+{
+	// Escapes in the text are ended with the cell, so they don't run into the border.
+	const bool escaped = visible != view.size() || !lead.empty();
+	if constexpr (kColor)
+		out += code;
+	out += lead;
+
+	if (visible <= width) {
+		IONIC_STAT(local.textBytes += view.size());
+		// It's only where the text fits that the alignment matters.
+		const size_t pad = width - visible;
+		switch (align) {
+		case Alignment::left:
+			out += view;
+			out.append(pad, ' ');
+			break;
+		case Alignment::right:
+			out.append(pad, ' ');
+			out += view;
+			break;
+		case Alignment::center:
+			out.append(pad / 2, ' ');
+			out += view;
+			out.append(pad - pad / 2, ' ');
+			break;
+		case Alignment::decimal: {
+			size_t right = std::min(pad, size_t(std::max(0, fracWidth - frac)));
+			out.append(pad - right, ' ');
+			out += view;
+			out.append(right, ' ');
+			break;
+		}
+		}
+	}
+	else {
+		IONIC_STAT(++local.truncations);
+		const std::string_view ellipsis = Table::kEllipsis;
+		if (width <= ellipsis.size()) {
+			out += ellipsis.substr(0, width);
+		}
+		else {
+			const size_t n = escaped ? visiblePrefix(view, width - ellipsis.size()) : width - ellipsis.size();
+			IONIC_STAT(local.textBytes += n);
+			out += view.substr(0, n);
+			out += ellipsis;
+		}
+	}
+
+	if ((kColor && !code.empty()) || escaped)
+		out += kResetCode;
+	(void)local;
+}
+
+// For truncated columns: the first line of the text, in place of wordWrap(). Only
+// width + 1 characters (and the escapes among them) are looked at; anything longer
+// is cut by emitCellLine().
+void firstLine(std::string_view text, int width, std::vector<Table::Break>& lines, const Table::Escapes* escapes)
+{
+	const size_t visible = size_t(std::max(width, 0)) + 1;
+	const size_t n = escapes ? visiblePrefix(text, visible) : std::min(text.size(), visible);
+	const size_t end = std::min(text.substr(0, n).find('\n'), n);
+	lines.resize(1);
+	lines[0] = Table::Break{ 0, end, end };
+}
+
+// Rows [first, last) of the source, with dividers between them. The options that
+// are constant for the whole render are template parameters, so the per-line path
+// is straight line code.
+template<bool kColor, bool kInnerHDivider, class Source>
+void emitRows(Renderer::Scratch& s, const Source& src, int first, int last, TableStats& local)
+{
+	const size_t nCols = s.innerColWidth.size();
+	std::string& out = s.out;
+	s.row.resize(nCols);
+	s.breaks.resize(nCols);
+	s.lines.resize(nCols);
+
+	for (int r = first; r < last; ++r) {
+		size_t nLines = 1;
+		{
+			IONIC_STAT(StatTimer timer(local.wrapTime));
+			for (size_t c = 0; c < nCols; ++c) {
+				const CellRef& cell = s.row[c] = src.cell(r, int(c));
+				std::vector<Table::Break>* lines = &s.breaks[c];
+				bool wrap = true;
+				if (cell.value >= 0) {
+					// Repeated values are only wrapped once per render.
+					std::vector<char>& wrapped = s.valueWrapped[c];
+					if (size_t(cell.value) >= wrapped.size()) {
+						wrapped.resize(size_t(cell.value) + 1, 0);
+						if (s.valueLines[c].size() < wrapped.size())
+							s.valueLines[c].resize(wrapped.size());
+					}
+					lines = &s.valueLines[c][cell.value];
+					wrap = !wrapped[cell.value];
+					wrapped[cell.value] = 1;
+				}
+				if (wrap) {
+					if (s.visibleCols[c].truncate)
+						firstLine(cell.text, s.innerColWidth[c], *lines, cell.escapes);
+					else
+						Table::wordWrap(cell.text, s.innerColWidth[c], *lines, cell.escapes);
+				}
+				s.lines[c] = lines;
+				nLines = std::max(nLines, lines->size());
+			}
+			IONIC_STAT(local.cellsWrapped += nCols);
+		}
+
+		for (size_t line = 0; line < nLines; ++line) {
+			out += s.frame.left;
+			for (size_t c = 0; c < nCols; ++c) {
+				if (c > 0)
+					out += s.frame.center;
+
+				const CellRef& cell = s.row[c];
+				std::string_view view;
+				size_t visible = 0;
+				std::string_view lead;
+				int frac = 0;
+				if (line < s.lines[c]->size()) {
+					const Table::Break& b = (*s.lines[c])[line];
+					view = cell.text.substr(b.start, b.end - b.start);
+					visible = view.size();
+					if (cell.alignment == Alignment::decimal)
+						frac = decimalFrac(cell.text, b.start, b.end, cell.escapes);
+					if (cell.escapes) {
+						visible = cell.escapes->visibleWidth(b.start, b.end);
+						// The sequences in the lines before carry on into this one.
+						s.lead.clear();
+						for (const Table::Escape& e : cell.escapes->escapes) {
+							if (e.pos >= b.start)
+								break;
+							s.lead += cell.text.substr(e.pos, e.size);
+						}
+						lead = s.lead;
+					}
+				}
+				assert(s.innerColWidth[c] >= 0);
+				emitCellLine<kColor>(out, view, visible, lead, size_t(s.innerColWidth[c]), cell.alignment, s.fracWidth[c], frac, cell.code, local);
+			}
+			out += s.frame.right;
+		}
+		if constexpr (kInnerHDivider) {
+			if (r + 1 < last)
+				out += s.frame.innerLine;
+		}
+	}
+}
+
+// The rows that fit the row budget (TableOptions::headRows and tailRows) of
+// another source: the first head rows, then the last tail rows.
+template<class Source>
+struct BudgetSource {
+	const Source& src;
+	int head;
+	int tail;
+
+	int nRows() const { return head + tail; }
+	CellRef cell(int r, int c) const { return src.cell(row(r), c); }
+	CellMeasure measure(int r, int c) const { return src.measure(row(r), c); }
+	bool decimal(int c) const { return src.decimal(c); }
+	int row(int r) const { return r < head ? r : src.nRows() - tail + (r - head); }
+};
+
+// One source's rows, then another's.
+template<class A, class B>
+struct ConcatSource {
+	const A& a;
+	const B& b;
+
+	int nRows() const { return a.nRows() + b.nRows(); }
+	CellRef cell(int r, int c) const { return r < a.nRows() ? a.cell(r, c) : b.cell(r - a.nRows(), c); }
+	CellMeasure measure(int r, int c) const { return r < a.nRows() ? a.measure(r, c) : b.measure(r - a.nRows(), c); }
+	bool decimal(int c) const { return a.decimal(c) || b.decimal(c); }
+};
+
+// Footer rows, formatted ahead of the render.
+struct FooterSource {
+	const std::vector<CellRef>& cells;
+	int nCols;
+
+	int nRows() const { return nCols > 0 ? int(cells.size()) / nCols : 0; }
+	CellRef cell(int r, int c) const { return cells[size_t(r) * nCols + c]; }
+	CellMeasure measure(int r, int c) const { return measureRef(cell(r, c)); }
+	bool decimal(int c) const {
+		for (int r = 0; r < nRows(); ++r) {
+			if (cell(r, c).alignment == Alignment::decimal)
+				return true;
+		}
+		return false;
+	}
+};
+
+// The columns of another source that are rendered.
+template<class Source>
+struct ProjectedSource {
+	const Source& src;
+	const std::vector<int>& columns;
+
+	int nRows() const { return src.nRows(); }
+	CellRef cell(int r, int c) const { return src.cell(r, columns[c]); }
+	CellMeasure measure(int r, int c) const { return src.measure(r, columns[c]); }
+	bool decimal(int c) const { return src.decimal(columns[c]); }
+};
+
+// Picks the columns to render: the visible ones, less those dropped to fit the
+// width (see TableOptions::dropWidth). Only the column formats are used.
+void selectColumns(const TableOptions& options, const std::vector<Table::Column>& cols, int outerWidth,
+	std::vector<int>& columns, std::vector<Table::Column>& visibleCols)
+{
+	columns.clear();
+	for (size_t i = 0; i < cols.size(); ++i) {
+		if (cols[i].visible)
+			columns.push_back(int(i));
+	}
+
+	if (options.dropWidth > 0) {
+		const int vDivWidth = options.innerVDivider ? 3 : 2;
+		auto needed = [&]() {
+			int w = options.indent + (options.outerBorder ? 4 : 0) + vDivWidth * (int(columns.size()) - 1);
+			for (int c : columns)
+				w += cols[c].type == ColType::fixed ? cols[c].requestedWidth : options.dropWidth;
+			return w;
+		};
+		while (columns.size() > 1 && needed() > outerWidth) {
+			size_t drop = 0;
+			for (size_t i = 1; i < columns.size(); ++i) {
+				if (cols[columns[i]].priority <= cols[columns[drop]].priority)
+					drop = i;
+			}
+			columns.erase(columns.begin() + drop);
+		}
+	}
+
+	visibleCols.clear();
+	for (int c : columns)
+		visibleCols.push_back(cols[c]);
+}
+
+// The text of the line that stands in for the rows left out by the row budget:
+// "... 48 more rows", or "+48" if that doesn't fit the width. The count is never cut.
+std::string_view elidedText(char (&buf)[48], int nElided, int width)
+{
+	int n = snprintf(buf, sizeof(buf), "... %d more row%s", nElided, nElided == 1 ? "" : "s");
+	if (n > width)
+		n = snprintf(buf, sizeof(buf), "+%d", nElided);
+	return std::string_view(buf, size_t(std::clamp(n, 0, int(sizeof(buf)) - 1)));
+}
+
+// The line that stands in for the rows left out. The layout has made room for it.
+void emitElided(std::string& out, const Frame& frame, int width, int nElided)
+{
+	char buf[48];
+	const std::string_view text = elidedText(buf, nElided, width);
+
+	out += frame.left;
+	out += text;
+	out.append(size_t(std::max(width - int(text.size()), 0)), ' ');
+	out += frame.right;
+}
+
+// Renders the rows of src, then the footer rows if footer is set. The column widths
+// are computed from layoutSrc if it is set (a view can be laid out like its whole
+// table), or else from the rows that are rendered. stats may be null; it is only
+// updated when compiled with IONIC_STATS. color is the resolved ColorPolicy; without
+// it, no escapes are written. The output goes to scratch.out.
+template<class Source, class LayoutSource>
+void renderTable(const TableOptions& options, bool color, const std::vector<Table::Column>& allCols, const Source& allSrc, const LayoutSource* layoutSrc,
+	const FooterSource* footer, TableStats* stats, Renderer::Scratch& scratch)
+{
+	std::string& out = scratch.out;
+	out.clear();
+	if (allCols.empty() || allSrc.nRows() == 0) {
+		return;
+	}
 
-		bool done = false;
-		size_t line = 0;
-		while (!done) {
-			done = true;
-			out.append(_options.indent, ' ');
-			printLeft(out);
-
-			for (size_t c = 0; c < _cols.size(); ++c) {
-				if (c > 0)
-					printCenter(out);
-
-				std::string view;
-				if (line < breaks[c].size()) {
-					if (line + 1 < breaks[c].size())
-						done = false;
-					const std::string& str = _rows[r][c].text;
-					view = str.substr(
-						breaks[c][line].start,
-						breaks[c][line].end - breaks[c][line].start);
-				}
+	// From here on, only the columns that are rendered are seen. Hidden cells aren't touched.
+	int outerWidth = options.maxWidth > 0 ? options.maxWidth : Table::consoleWidth();
+	selectColumns(options, allCols, outerWidth, scratch.columns, scratch.visibleCols);
+	const std::vector<Table::Column>& cols = scratch.visibleCols;
+	if (cols.empty()) {
+		return;
+	}
+	const ProjectedSource<Source> src{ allSrc, scratch.columns };
+	const FooterSource noFooter{ scratch.footer, 0 };
+	const ProjectedSource<FooterSource> footerRows{ footer ? *footer : noFooter, scratch.columns };
+
+	// With a row budget, only the rows that are shown are measured, wrapped, and emitted.
+	int head = src.nRows();
+	int tail = 0;
+	if (options.headRows >= 0 && options.headRows + std::max(0, options.tailRows) < src.nRows()) {
+		head = options.headRows;
+		tail = std::max(0, options.tailRows);
+	}
+	const BudgetSource<ProjectedSource<Source>> rows{ src, head, tail };
+	const int nElided = src.nRows() - head - tail;
+	const int nRows = rows.nRows();
 
-				assert(innerColWidth[c] >= 0);
-				size_t width = innerColWidth[c];
-				{
-					Dye dye(_rows[r][c].color, out);
-					Alignment align = _rows[r][c].alignment;
-
-					if (view.size() <= width) {
-						// It's only where the text fits that the alignment matters.
-						if (align == Alignment::left) {
-							out += view;
-							out.append(width - view.size(), ' ');
-						}
-						else if (align == Alignment::right) {
-							out.append(width - view.size(), ' ');
-							out += view;
-						}
-						else if (align == Alignment::center) {
-							int left = int(width - view.size()) / 2;
-							out.append(left, ' ');
-							out += view;
-							out.append(width - left - view.size(), ' ');
-						}
-					}
-					else {
-						const std::string ellipsis = kEllipsis;
-						if (width <= ellipsis.size()) {
-							out += ellipsis.substr(0, width);
-						}
-						else {
-							out += view.substr(0, width - ellipsis.size());
-							out += ellipsis;
-						}
+	TableStats local;
+	double totalTime = 0;
+	(void)totalTime;
+	{
+		IONIC_STAT(StatTimer totalTimer(totalTime));
+
+		int vDivWidth = options.innerVDivider ? 3 : 2;
+
+		int innerWidth = outerWidth - options.indent;
+		if (options.outerBorder)
+			innerWidth -= 2 * 2;	// 2 for each border
+		innerWidth -= vDivWidth * (int(cols.size()) - 1);	// 3 for each inner border
+
+		std::vector<int>& innerColWidth = scratch.innerColWidth;
+		{
+			IONIC_STAT(StatTimer timer(local.layoutTime));
+			bool kept = false;
+			if constexpr (KeepsMaxima<Source>::value) {
+				// A bounded table keeps the maxima of its columns; only the footer rows are measured.
+				if (!layoutSrc && nElided == 0 && options.widthSampleRows <= 0)
+					kept = allSrc.maxima(scratch.columns, scratch.measures);
+			}
+			if (kept)
+				computeWidths(options, cols, footerRows, innerWidth, innerColWidth, scratch.fracWidth, scratch.sample, scratch.measures.data());
+			else if (layoutSrc)
+				computeWidths(options, cols, ProjectedSource<LayoutSource>{ *layoutSrc, scratch.columns }, innerWidth, innerColWidth, scratch.fracWidth, scratch.sample);
+			else if (footerRows.nRows() > 0)
+				computeWidths(options, cols, ConcatSource<decltype(rows), decltype(footerRows)>{ rows, footerRows }, innerWidth, innerColWidth, scratch.fracWidth, scratch.sample);
+			else
+				computeWidths(options, cols, rows, innerWidth, innerColWidth, scratch.fracWidth, scratch.sample);
+			if (nRows == 0) {
+				// Everything was left out; flex columns get a minimum width for the "..." line.
+				for (size_t i = 0; i < cols.size(); ++i) {
+					if (cols[i].type == ColType::flex)
+						innerColWidth[i] = std::max(innerColWidth[i], Table::kMinWidth);
+				}
+			}
+			if (nElided > 0) {
+				// The last flex column (or the last column) is widened for the elided line,
+				// in its long form if it fits the table's width.
+				const int dividers = vDivWidth * (int(cols.size()) - 1);
+				const int width = std::accumulate(innerColWidth.begin(), innerColWidth.end(), 0) + dividers;
+				char buf[48];
+				const int needed = int(elidedText(buf, nElided, std::max(width, innerWidth + dividers)).size());
+				if (needed > width) {
+					size_t widen = cols.size() - 1;
+					for (size_t i = 0; i < cols.size(); ++i) {
+						if (cols[i].type == ColType::flex)
+							widen = i;
 					}
+					innerColWidth[widen] += needed - width;
 				}
 			}
-			++line;
-			printRight(out);
-			out += '\n';
 		}
-		if (r + 1 < _rows.size()) {
-			printHorizontalBorder(out, innerColWidth, false);
+		
+		/*
+			Fixed(1), Dynamic, Wrap
+			Inner
+			  1   5       15
+			+---+-------+-----------------+
+		    | 0 | A     | The Outer World |
+			+---+-------+-----------------+
+			| 1 | Hello | And Another     |
+			+---+-------+-----------------+ extra y
+		
+		*/
+
+		out.reserve(outerWidth * (nRows + 1) * 2);	// rough guess
+
+		const Frame& frame = scratch.frame;
+		buildFrame(options, color, innerColWidth, footerRows.nRows() > 0, scratch.frame);
+
+		// The widths are new, so nothing cached is wrapped yet. (The capacity is kept.)
+		scratch.valueLines.resize(cols.size());
+		scratch.valueWrapped.resize(cols.size());
+		for (std::vector<char>& wrapped : scratch.valueWrapped)
+			wrapped.clear();
+		out += frame.topLine;
+
+		auto emit = [&](const auto& source, int first, int last) {
+			if (color && options.innerHDivider)
+				emitRows<true, true>(scratch, source, first, last, local);
+			else if (color)
+				emitRows<true, false>(scratch, source, first, last, local);
+			else if (options.innerHDivider)
+				emitRows<false, true>(scratch, source, first, last, local);
+			else
+				emitRows<false, false>(scratch, source, first, last, local);
+		};
+
+		emit(rows, 0, head);
+		if (nElided > 0) {
+			if (head > 0)
+				out += frame.innerLine;
+			int width = std::accumulate(innerColWidth.begin(), innerColWidth.end(), 0) + vDivWidth * (int(cols.size()) - 1);
+			emitElided(out, frame, width, nElided);
+			if (tail > 0)
+				out += frame.innerLine;
+			emit(rows, head, head + tail);
 		}
+		if (footerRows.nRows() > 0) {
+			out += frame.footerLine;
+			emit(footerRows, 0, footerRows.nRows());
+		}
+
+		out += frame.bottomLine;
 	}
 
-	printHorizontalBorder(out, innerColWidth, true);
-	
-	return out;
+#if IONIC_STATS
+	if (stats) {
+		stats->formats++;
+		stats->layoutTime += local.layoutTime;
+		stats->wrapTime += local.wrapTime;
+		stats->emitTime += totalTime - local.layoutTime - local.wrapTime;
+		stats->cellsWrapped += local.cellsWrapped;
+		stats->linesEmitted += std::count(out.begin(), out.end(), '\n');
+		stats->truncations += local.truncations;
+		stats->textBytes += local.textBytes;
+		stats->escapeBytes += countEscapeBytes(out);
+	}
+#else
+	(void)stats;
+#endif
+}
+
+} // namespace
+
+// -- Spilling -- //
+
+struct Table::SpillFile {
+	SpillFile() : fp(std::tmpfile()) {
+		static std::atomic<uint64_t> next{ 0 };
+		id = ++next;
+	}
+	~SpillFile() {
+		if (fp)
+			std::fclose(fp);
+	}
+	SpillFile(const SpillFile&) = delete;
+	SpillFile& operator=(const SpillFile&) = delete;
+
+	// Reads n bytes at the offset. Concurrent renders share the file, so seek and read are locked together.
+	bool read(uint64_t offset, char* dst, size_t n) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return seek(offset) && std::fread(dst, 1, n, fp) == n;
+	}
+	bool seek(uint64_t offset) {
+#if defined(_WIN32)
+		return _fseeki64(fp, int64_t(offset), SEEK_SET) == 0;
+#else
+		return fseeko(fp, off_t(offset), SEEK_SET) == 0;
+#endif
+	}
+
+	std::FILE* fp = nullptr;
+	uint64_t id = 0;		// unique per file, so a SpillCache doesn't mix up files
+	uint64_t size = 0;		// what has been appended
+	bool failed = false;	// after a failed write, nothing more is spilled
+	std::mutex mutex;
+};
+
+size_t Table::encode(Row& row)
+{
+	size_t bytes = 0;
+	for (size_t c = 0; c < row.size(); ++c) {
+		Cell& cell = row[c];
+		if (c < _cols.size() && _cols[c].dictionary) {
+			while (_dictionaries.size() < _cols.size())
+				_dictionaries.emplace_back(_resource);
+			// Looked up first, so a dictionary shared with a snapshot is only copied for a new value.
+			auto it = _dictionaries[c]->index.find(cell.text);
+			if (it == _dictionaries[c]->index.end()) {
+				Dictionary& dict = _dictionaries[c].edit();
+				it = dict.index.emplace(cell.text, int(dict.values.size())).first;
+				dict.values.push_back(std::move(cell.text));
+				if (cell.escapes == kFindEscapes) {
+					dict.escapes.resize(dict.values.size());
+					findEscapes(dict.values.back(), dict.escapes.back());
+				}
+			}
+			cell.value = it->second;
+			cell.escapes = cell.escapes == kFindEscapes ? cell.value : -1;	// the same text has the same escapes
+			cell.text = std::pmr::string(cell.text.get_allocator());	// frees it
+		}
+		bytes += cell.text.size();
+	}
+	return bytes;
 }
 
+void Table::addResident(size_t bytes)
+{
+	_residentBytes += bytes;
+	if (_options.memoryBudget > 0 && _options.maxRows <= 0 && _residentBytes > _options.memoryBudget)
+		spill();
+}
 
-void Table::printHorizontalBorder(std::string& s, const std::vector<int>& innerColWidth, bool outer) const
+void Table::spill()
 {
-	if (outer && !_options.outerBorder)
-		return;
-	if (!outer && !_options.innerHDivider)
+	if (!_spill)
+		_spill = std::make_shared<SpillFile>();
+	SpillFile& file = *_spill;
+
+	std::lock_guard<std::mutex> lock(file.mutex);
+	if (!file.fp || file.failed)
+		return;	// the text stays in memory
+
+	Segment seg;
+	seg.firstRow = _spilledRows;
+	seg.nRows = nRows() - _spilledRows;
+	seg.offset = file.size;
+	bool ok = file.seek(file.size);
+	for (int r = seg.firstRow; ok && r < nRows(); ++r) {
+		for (const Cell& cell : _rows[r]) {
+			const uint32_t n = uint32_t(cell.text.size());
+			ok = ok && std::fwrite(&n, sizeof(n), 1, file.fp) == 1
+				&& std::fwrite(cell.text.data(), 1, n, file.fp) == n;
+			seg.size += sizeof(n) + n;
+		}
+	}
+	ok = ok && std::fflush(file.fp) == 0;
+	if (!ok) {
+		file.failed = true;
 		return;
+	}
+
+	file.size += seg.size;
+	for (int r = seg.firstRow; r < nRows(); ++r) {
+		for (Cell& cell : _rows.edit(r))
+			cell.text = std::pmr::string(cell.text.get_allocator());	// frees it
+	}
+	_segments.push_back(seg);
+	_spilledRows = nRows();
+	_residentBytes = 0;
+}
+
+size_t Table::push(Row&& row)
+{
+	const size_t bytes = encode(row);
+	for (size_t c = 0; c < row.size(); ++c) {
+		if (_styles[row[c].style].alignment == Alignment::decimal)
+			markDecimal(c);
+	}
+	_rows.push_back(std::move(row));
+	if (_options.maxRows <= 0)
+		return bytes;
+
+	if (_maximaStale) {
+		// Once per change of alignment, rather than on every setCell().
+		_maxima.clear();
+		_maximaStale = false;
+		for (size_t r = 0; r < _rows.size(); ++r)
+			measure(r);
+	}
+	else {
+		measure(_rows.size() - 1);
+	}
+	while (_rows.size() > size_t(_options.maxRows)) {
+		_rows.pop_front();
+		for (Maxima& m : _maxima) {
+			m.width.drop(_dropped);
+			m.decimalInt.drop(_dropped);
+			m.decimalFrac.drop(_dropped);
+		}
+		++_dropped;
+	}
+	return bytes;
+}
 
-	std::string buf;
+void Table::measure(size_t r)
+{
+	const Row& row = _rows[r];
+	if (_maxima.size() < row.size())
+		_maxima.resize(row.size());
+	const uint64_t n = _dropped + r;
+	for (size_t c = 0; c < row.size(); ++c) {
+		const Cell& cell = row[c];
+		Maxima& m = _maxima[c];
+		m.width.push(n, c < _cols.size() && _cols[c].truncate ? cell.firstWidth : cell.desiredWidth);
+		if (_styles[cell.style].alignment == Alignment::decimal) {
+			m.decimalInt.push(n, cell.decimalInt);
+			m.decimalFrac.push(n, cell.decimalFrac);
+		}
+	}
+}
 
-	{
-		buf.append(_options.indent, ' ');
-		Dye dye(_options.tableColor, buf);
-		if (_options.outerBorder) {
-			for (size_t c = 0; c < _cols.size(); ++c) {
-				if (c == 0 || _options.innerVDivider)
-					buf += _options.borderCornerChar;
-				buf.append(2 + innerColWidth[c], _options.borderHChar);
+void Table::MaxQueue::push(uint64_t row, int value)
+{
+	// Smaller values before this one can't be the maximum again.
+	while (!q.empty() && q.back().second <= value)
+		q.pop_back();
+	q.emplace_back(row, value);
+}
+
+void Table::restyle(Cell& cell, size_t col, StyleIndex style)
+{
+	const bool decimal = _styles[style].alignment == Alignment::decimal;
+	if ((_styles[cell.style].alignment == Alignment::decimal) != decimal)
+		_maximaStale = true;
+	if (decimal)
+		markDecimal(col);
+	cell.style = style;
+}
+
+void Table::markDecimal(size_t col)
+{
+	if (_decimalCols.size() <= col)
+		_decimalCols.resize(col + 1, 0);
+	_decimalCols[col] = 1;
+}
+
+struct Table::Source {
+	const Table& t;
+	SpillCache* cache = nullptr;	// for rows that were spilled; required if there are any
+
+	int nRows() const { return t.nRows(); }
+	CellRef cell(int r, int c) const {
+		CellRef ref = resident(r, c);
+		if (ref.value < 0 && r < t._spilledRows)
+			ref.text = spilledText(r, c);
+		return ref;
+	}
+	// As cell(), but the text of a spilled cell is left empty rather than read.
+	CellRef resident(int r, int c) const {
+		const Cell& cell = t._rows[r][c];
+		std::string_view text = cell.text;
+		if (cell.value >= 0)
+			text = t._dictionaries[c]->values[cell.value];
+		const Escapes* escapes = nullptr;
+		if (cell.escapes >= 0)
+			escapes = cell.value >= 0 ? &t._dictionaries[c]->escapes[cell.escapes] : &t._rows.escapes(size_t(r), cell.escapes);
+		return CellRef{ text, cell.desiredWidth, cell.nLines, t._styleCodes[cell.style], t._styles[cell.style].alignment, cell.value, escapes };
+	}
+
+	// Measured when the cell was added, so spilled text isn't read back for the layout.
+	CellMeasure measure(int r, int c) const {
+		const Cell& cell = t._rows[r][c];
+		return CellMeasure{ cell.desiredWidth, t._styles[cell.style].alignment, cell.decimalInt, cell.decimalFrac, cell.firstWidth };
+	}
+	bool decimal(int c) const { return size_t(c) < t._decimalCols.size() && t._decimalCols[c]; }
+
+	// The measures of the columns kept by a table with maxRows. False if it doesn't keep them.
+	bool maxima(const std::vector<int>& columns, std::vector<ColumnMeasure>& measures) const {
+		if (t._options.maxRows <= 0 || t._maximaStale)
+			return false;
+		measures.clear();
+		for (int c : columns) {
+			ColumnMeasure m;
+			if (size_t(c) < t._maxima.size()) {
+				m.width = t._maxima[c].width.max();
+				m.maxInt = t._maxima[c].decimalInt.max();
+				m.maxFrac = t._maxima[c].decimalFrac.max();
 			}
-			buf += _options.borderCornerChar;
+			measures.push_back(m);
 		}
-		else {
-			buf.append(1 + innerColWidth[0], _options.borderHChar);
-			for (size_t c = 1; c < _cols.size(); ++c) {
-				buf += _options.borderCornerChar;
-				buf.append(2 + innerColWidth[c], _options.borderHChar);
+		return true;
+	}
+
+	// The text is valid until a row from another segment is read.
+	std::string_view spilledText(int r, int c) const {
+		assert(cache);
+		if (!cache)
+			return std::string_view();
+		auto it = std::upper_bound(t._segments.begin(), t._segments.end(), r,
+			[](int row, const Segment& seg) { return row < seg.firstRow; });
+		assert(it != t._segments.begin());
+		const Segment& seg = *(it - 1);
+		const size_t nCols = t._rows[r].size();
+
+		if (!cache->loaded || cache->file != t._spill->id || cache->offset != seg.offset) {
+			// The whole segment in one read, as rows are mostly read in order.
+			IONIC_STAT(t._stats.spillReads++);
+			cache->file = t._spill->id;
+			cache->offset = seg.offset;
+			cache->loaded = true;
+			cache->data.resize(size_t(seg.size));
+			cache->cells.assign(size_t(seg.nRows) * nCols, std::string_view());
+			if (t._spill->read(seg.offset, cache->data.data(), cache->data.size())) {
+				size_t pos = 0;
+				for (std::string_view& text : cache->cells) {
+					uint32_t n = 0;
+					if (pos + sizeof(n) > cache->data.size())
+						break;
+					memcpy(&n, cache->data.data() + pos, sizeof(n));
+					pos += sizeof(n);
+					n = uint32_t(std::min<size_t>(n, cache->data.size() - pos));
+					text = std::string_view(cache->data.data() + pos, n);
+					pos += n;
+				}
+			}
+		}
+		return cache->cells[size_t(r - seg.firstRow) * nCols + c];
+	}
+
+	// Formats the footer rows into the scratch space. The strings are reused between renders.
+	FooterSource footer(Renderer::Scratch& s) const {
+		const size_t nCols = t._cols.size();
+		s.footer.clear();
+		s.footerText.resize(t._footers.size() * nCols);
+		s.footerEscapes.resize(s.footerText.size());
+		for (size_t f = 0; f < t._footers.size(); ++f) {
+			const Footer& footer = t._footers[f];
+			bool labeled = false;
+			for (size_t c = 0; c < nCols; ++c) {
+				std::string& text = s.footerText[f * nCols + c];
+				text.clear();
+				CellRef ref;
+				StyleIndex style = kTextStyle;
+				const Aggregate aggregate = c < footer.aggregates.size() ? footer.aggregates[c] : Aggregate::none;
+				if (aggregate == Aggregate::none) {
+					if (!labeled) {
+						text = footer.label;
+						labeled = true;
+					}
+					if (findEscapes(text, s.footerEscapes[f * nCols + c]))
+						ref.escapes = &s.footerEscapes[f * nCols + c];
+					ref.nLines = nLines(text, ref.desiredWidth, ref.escapes);
+				}
+				else {
+					const double v = t.aggregate(int(c), aggregate);
+					if (!std::isnan(v)) {
+						// A count is always an integer, and a mean is written with the column's precision.
+						const Column& col = t._cols[c];
+						char buf[kMaxValueChars];
+						if (aggregate == Aggregate::count)
+							text.assign(formatNumber(buf, Value(uint64_t(v)), ValueFormat::automatic, 0));
+						else if (aggregate == Aggregate::mean && col.format == ValueFormat::automatic)
+							text.assign(formatNumber(buf, Value(v), ValueFormat::floating, col.precision));
+						else
+							text.assign(formatNumber(buf, Value(v), col.format, col.precision));
+					}
+					ref.desiredWidth = int(text.size());
+					ref.nLines = 1;
+					style = t._numberStyle;
+				}
+				ref.text = text;
+				ref.code = t._styleCodes[style];
+				ref.alignment = t._styles[style].alignment;
+				s.footer.push_back(ref);
 			}
 		}
+		return FooterSource{ s.footer, int(nCols) };
+	}
+};
+
+void Table::addFooter(const std::string& label, const std::vector<Aggregate>& aggregates)
+{
+	_footers.push_back(Footer{ label, aggregates });
+	normalizeNL(_footers.back().label);
+	std::vector<size_t> added;	// columns aggregated from now on
+	for (size_t c = 0; c < aggregates.size(); ++c) {
+		if (aggregates[c] == Aggregate::none)
+			continue;
+		if (_aggregated.size() <= c)
+			_aggregated.resize(c + 1, 0);
+		if (!_aggregated[c])
+			added.push_back(c);
+		_aggregated[c] = 1;
+	}
+	if (_aggregates.size() < _aggregated.size())
+		_aggregates.resize(_aggregated.size());
+
+	// One pass to catch up with the rows already added, in row order so spilled
+	// segments are read once.
+	if (added.empty() || nRows() == 0)
+		return;
+	SpillCache cache;
+	const Source src{ *this, &cache };
+	for (int r = 0; r < nRows(); ++r) {
+		for (size_t c : added) {
+			double v;
+			if (c < _rows[r].size() && parseExact(src.cell(r, int(c)).text, v))
+				_aggregates[c].add(v);
+		}
+	}
+}
+
+void Table::print() const
+{
+	initConsole();
+	std::string s = format();
+	IONIC_STAT(StatTimer timer(_stats.writeTime));
+	std::cout << s;
+}
+
+std::string Table::format() const
+{
+	return format(_options.color);
+}
+
+std::string Table::format(ColorPolicy color) const
+{
+	Renderer::Scratch scratch;
+	const Source src{ *this, &scratch.spill };
+	const FooterSource footer = src.footer(scratch);
+	renderTable(_options, useColor(color), _cols, src, (const Source*)nullptr, &footer, &_stats, scratch);
+	return std::move(scratch.out);
+}
+
+TableStats Table::stats() const
+{
+	TableStats s = _stats;
+#if IONIC_STATS
+	s.cellBytes = _rows.bytes();
+	for (size_t r = 0; r < _rows.size(); ++r) {
+		for (const Cell& cell : _rows[r]) {
+			// Short strings are stored in the Cell itself.
+			if (cell.text.capacity() > std::string().capacity())
+				s.cellBytes += cell.text.capacity() + 1;
+		}
+	}
+	for (const Shared<Dictionary>& dict : _dictionaries) {
+		for (const std::pmr::string& value : dict->values)
+			s.cellBytes += sizeof(value) + (value.capacity() > std::string().capacity() ? value.capacity() + 1 : 0);
+	}
+#endif
+	return s;
+}
+
+void Table::resetStats()
+{
+	_stats = TableStats();
+}
+
+// -- Snapshots -- //
+//
+// A snapshot is laid out so that it can be used in place once mapped:
+//   SnapHeader
+//   SnapColumn[nCols]
+//   SnapStyle[nStyles]         (the style palette)
+//   SnapCell[nRows * nCols]    (row major)
+//   text                       (all the cell text, referenced by offset from the SnapCells)
+// Everything is fixed size and 8 byte aligned, written in native byte order. The
+// endian field is checked on open; snapshots don't move between architectures.
+//
+namespace {
+
+constexpr char kSnapMagic[8] = { 'I', 'O', 'N', 'I', 'C', 'T', 'B', 'L' };
+constexpr uint32_t kSnapVersion = 2;
+constexpr uint32_t kSnapEndian = 0x01020304;
+
+struct SnapOptions {
+	uint8_t outerBorder;
+	uint8_t innerHDivider;
+	uint8_t innerVDivider;
+	char borderHChar;
+	char borderVChar;
+	char borderCornerChar;
+	uint8_t tableColor;
+	uint8_t textColor;
+	uint8_t alignment;
+	uint8_t borderStyle;	// 0 (ascii) in files from before there were border styles
+	uint8_t pad[2];
+	int32_t maxWidth;
+	int32_t indent;
+};
+
+struct SnapHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t nRows;
+	uint32_t nCols;
+	uint32_t nStyles;
+	uint32_t pad;
+	uint64_t colOffset;
+	uint64_t styleOffset;
+	uint64_t cellOffset;
+	uint64_t textOffset;
+	uint64_t textSize;
+	SnapOptions options;
+};
+
+struct SnapColumn {
+	uint8_t type;
+	uint8_t flags;			// kSnapHidden, kSnapTruncate
+	int16_t priority;
+	int32_t requestedWidth;
+};
+
+struct SnapStyle {
+	uint8_t fg[4];			// kind, value[3]
+	uint8_t bg[4];
+	uint8_t flags;			// bold, dim, underline
+	uint8_t alignment;
+	uint8_t pad[6];
+};
+
+struct SnapCell {
+	uint64_t offset;		// into the text section
+	uint32_t size;
+	int32_t desiredWidth;
+	int32_t nLines;
+	uint16_t style;			// into the palette
+	uint8_t flags;			// kSnapEscapes (0 in older files, which are rendered by bytes)
+	uint8_t pad;
+};
+
+static_assert(sizeof(SnapHeader) % 8 == 0, "snapshot sections must stay aligned");
+static_assert(sizeof(SnapColumn) == 8, "snapshot sections must stay aligned");
+static_assert(sizeof(SnapStyle) == 16, "snapshot sections must stay aligned");
+static_assert(sizeof(SnapCell) == 24, "snapshot sections must stay aligned");
+
+Alignment toAlignment(uint8_t a)
+{
+	return a <= uint8_t(Alignment::decimal) ? Alignment(a) : Alignment::left;
+}
+
+enum : uint8_t { kSnapBold = 1, kSnapDim = 2, kSnapUnderline = 4 };
+// kSnapNoDecimal is set if no cell in the column is decimal aligned. (Older files
+// don't have it, so their columns are all scanned for decimal alignment.)
+enum : uint8_t { kSnapHidden = 1, kSnapTruncate = 2, kSnapNoDecimal = 4 };
+enum : uint8_t { kSnapEscapes = 1 };	// the cell text has escape sequences
+
+void toSnap(const TermColor& tc, uint8_t out[4])
+{
+	out[0] = uint8_t(tc.kind);
+	memcpy(out + 1, tc.value, 3);
+}
+
+TermColor fromSnap(const uint8_t in[4])
+{
+	TermColor tc;
+	if (in[0] > uint8_t(TermColor::Kind::rgb))
+		return tc;
+	tc.kind = TermColor::Kind(in[0]);
+	memcpy(tc.value, in + 1, 3);
+	if (tc.kind == TermColor::Kind::basic && tc.value[0] >= uint8_t(Color::kDefault))
+		return TermColor();
+	return tc;
+}
+
+} // namespace
+
+bool Table::save(const std::string& path) const
+{
+	std::FILE* fp = std::fopen(path.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	SnapHeader h{};
+	memcpy(h.magic, kSnapMagic, sizeof(h.magic));
+	h.version = kSnapVersion;
+	h.endian = kSnapEndian;
+	h.nRows = uint32_t(_rows.size());
+	h.nCols = uint32_t(_cols.size());
+	h.nStyles = uint32_t(_styles.size());
+	h.colOffset = sizeof(SnapHeader);
+	h.styleOffset = h.colOffset + sizeof(SnapColumn) * _cols.size();
+	h.cellOffset = h.styleOffset + sizeof(SnapStyle) * _styles.size();
+	h.textOffset = h.cellOffset + sizeof(SnapCell) * _cols.size() * _rows.size();
+
+	h.options.outerBorder = _options.outerBorder;
+	h.options.innerHDivider = _options.innerHDivider;
+	h.options.innerVDivider = _options.innerVDivider;
+	h.options.borderHChar = _options.borderHChar;
+	h.options.borderVChar = _options.borderVChar;
+	h.options.borderCornerChar = _options.borderCornerChar;
+	h.options.borderStyle = uint8_t(_options.borderStyle);
+	h.options.tableColor = uint8_t(_options.tableColor);
+	h.options.textColor = uint8_t(_options.textColor);
+	h.options.alignment = uint8_t(_options.alignment);
+	h.options.maxWidth = _options.maxWidth;
+	h.options.indent = _options.indent;
+
+	// Spilled text is read back a segment at a time.
+	SpillCache cache;
+	const Source src{ *this, &cache };
+	for (int r = 0; r < nRows(); ++r) {
+		for (int c = 0; c < nCols(); ++c)
+			h.textSize += src.cell(r, c).text.size();
+	}
+
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+	for (size_t i = 0; i < _cols.size(); ++i) {
+		const Column& col = _cols[i];
+		const bool decimal = src.decimal(int(i));
+		SnapColumn sc{};
+		sc.type = uint8_t(col.type);
+		sc.flags = uint8_t((col.visible ? 0 : kSnapHidden) | (col.truncate ? kSnapTruncate : 0) | (decimal ? 0 : kSnapNoDecimal));
+		sc.priority = int16_t(std::clamp(col.priority, int(std::numeric_limits<int16_t>::min()), int(std::numeric_limits<int16_t>::max())));
+		sc.requestedWidth = col.requestedWidth;
+		ok = ok && fwrite(&sc, sizeof(sc), 1, fp) == 1;
+	}
+	for (const Style& style : _styles) {
+		SnapStyle ss{};
+		toSnap(style.fg, ss.fg);
+		toSnap(style.bg, ss.bg);
+		ss.flags = uint8_t((style.bold ? kSnapBold : 0) | (style.dim ? kSnapDim : 0) | (style.underline ? kSnapUnderline : 0));
+		ss.alignment = uint8_t(style.alignment);
+		ok = ok && fwrite(&ss, sizeof(ss), 1, fp) == 1;
+	}
+	uint64_t offset = 0;
+	for (int r = 0; r < nRows(); ++r) {
+		for (int c = 0; c < nCols(); ++c) {
+			const Cell& cell = _rows[r][c];
+			const size_t size = src.cell(r, c).text.size();
+			SnapCell sc{};
+			sc.offset = offset;
+			sc.size = uint32_t(size);
+			sc.desiredWidth = cell.desiredWidth;
+			sc.nLines = cell.nLines;
+			sc.style = cell.style;
+			sc.flags = cell.escapes != -1 ? kSnapEscapes : 0;
+			ok = ok && fwrite(&sc, sizeof(sc), 1, fp) == 1;
+			offset += size;
+		}
+	}
+	for (int r = 0; r < nRows(); ++r) {
+		for (int c = 0; c < nCols(); ++c) {
+			std::string_view text = src.cell(r, c).text;
+			ok = ok && fwrite(text.data(), 1, text.size(), fp) == text.size();
+		}
+	}
+	ok = (fclose(fp) == 0) && ok;
+	return ok;
+}
+
+struct MappedTable::Source {
+	const MappedTable& t;
+	std::vector<Table::Escapes>* escapes = nullptr;	// render scratch: per column, the cell's escape sequences
+
+	int nRows() const { return t._nRows; }
+	CellRef cell(int r, int c) const {
+		SnapCell sc;
+		CellRef ref = read(r, c, sc);
+		findEscapes(sc, c, ref);
+		return ref;
+	}
+	// The text is in the map, so decimal cells are measured from it.
+	CellMeasure measure(int r, int c) const { return measureRef(cell(r, c)); }
+	bool decimal(int c) const { return t._decimalCols[c] != 0; }
+
+private:
+	// The index isn't saved; the few cells with escapes are scanned again.
+	void findEscapes(const SnapCell& sc, int c, CellRef& ref) const {
+		if ((sc.flags & kSnapEscapes) && escapes) {
+			if (escapes->size() < t._cols.size())
+				escapes->resize(t._cols.size());
+			if (Table::findEscapes(ref.text, (*escapes)[c]))
+				ref.escapes = &(*escapes)[c];
+		}
+	}
+	CellRef read(int r, int c, SnapCell& sc) const {
+		// memcpy, rather than a cast, as the map isn't an array of SnapCell objects.
+		memcpy(&sc, t._cells + sizeof(SnapCell) * (size_t(r) * t._cols.size() + c), sizeof(sc));
+
+		CellRef ref;
+		if (sc.offset <= t._textSize && sc.size <= t._textSize - sc.offset)
+			ref.text = std::string_view(t._text + sc.offset, sc.size);
+		ref.desiredWidth = sc.desiredWidth;
+		ref.nLines = sc.nLines;
+		if (sc.style < t._styles.size()) {
+			ref.code = t._styleCodes[sc.style];
+			ref.alignment = t._styles[sc.style].alignment;
+		}
+		return ref;
+	}
+};
+
+bool MappedTable::open(const std::string& path)
+{
+	close();
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart < LONGLONG(sizeof(SnapHeader))) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	_file = file;
+	_mapping = mapping;
+	_size = size_t(size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < off_t(sizeof(SnapHeader))) {
+		::close(fd);
+		return false;
 	}
-	s += buf;
-	s.push_back('\n');
+	void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);	// the mapping keeps the file open
+	if (data == MAP_FAILED)
+		return false;
+	_size = size_t(st.st_size);
+#endif
+	_data = static_cast<const uint8_t*>(data);
+
+	// Only the header is checked; the cells are used in place.
+	SnapHeader h;
+	memcpy(&h, _data, sizeof(h));
+	const uint64_t nCells = uint64_t(h.nRows) * h.nCols;
+	if (memcmp(h.magic, kSnapMagic, sizeof(h.magic)) != 0
+		|| h.version != kSnapVersion
+		|| h.endian != kSnapEndian
+		|| h.colOffset + sizeof(SnapColumn) * uint64_t(h.nCols) > _size
+		|| h.styleOffset + sizeof(SnapStyle) * uint64_t(h.nStyles) > _size
+		|| h.nStyles > uint32_t(Table::kMaxStyles)
+		|| h.cellOffset + sizeof(SnapCell) * nCells > _size
+		|| h.textOffset > _size
+		|| h.textSize > _size - h.textOffset)
+	{
+		close();
+		return false;
+	}
+
+	_options.outerBorder = h.options.outerBorder != 0;
+	_options.innerHDivider = h.options.innerHDivider != 0;
+	_options.innerVDivider = h.options.innerVDivider != 0;
+	_options.borderHChar = h.options.borderHChar;
+	_options.borderVChar = h.options.borderVChar;
+	_options.borderCornerChar = h.options.borderCornerChar;
+	_options.borderStyle = h.options.borderStyle <= uint8_t(BorderStyle::rounded) ? BorderStyle(h.options.borderStyle) : BorderStyle::ascii;
+	_options.tableColor = Color(h.options.tableColor);
+	_options.textColor = Color(h.options.textColor);
+	_options.alignment = toAlignment(h.options.alignment);
+	_options.maxWidth = h.options.maxWidth;
+	_options.indent = h.options.indent;
+
+	_cols.resize(h.nCols);
+	_decimalCols.resize(h.nCols);
+	for (uint32_t i = 0; i < h.nCols; ++i) {
+		SnapColumn sc;
+		memcpy(&sc, _data + h.colOffset + sizeof(SnapColumn) * i, sizeof(sc));
+		_cols[i].type = sc.type == uint8_t(ColType::fixed) ? ColType::fixed : ColType::flex;
+		_cols[i].requestedWidth = sc.requestedWidth;
+		_cols[i].visible = (sc.flags & kSnapHidden) == 0;
+		_cols[i].truncate = (sc.flags & kSnapTruncate) != 0;
+		_cols[i].priority = sc.priority;
+		_decimalCols[i] = (sc.flags & kSnapNoDecimal) == 0;
+	}
+	// The palette is small, so it is read rather than used in place.
+	_styles.resize(h.nStyles);
+	_styleCodes.resize(h.nStyles);
+	for (uint32_t i = 0; i < h.nStyles; ++i) {
+		SnapStyle ss;
+		memcpy(&ss, _data + h.styleOffset + sizeof(SnapStyle) * i, sizeof(ss));
+		Style& style = _styles[i];
+		style.fg = fromSnap(ss.fg);
+		style.bg = fromSnap(ss.bg);
+		style.bold = (ss.flags & kSnapBold) != 0;
+		style.dim = (ss.flags & kSnapDim) != 0;
+		style.underline = (ss.flags & kSnapUnderline) != 0;
+		style.alignment = toAlignment(ss.alignment);
+		_styleCodes[i] = styleCode(style);
+	}
+	_nRows = int(h.nRows);
+	_cells = _data + h.cellOffset;
+	_text = reinterpret_cast<const char*>(_data + h.textOffset);
+	_textSize = h.textSize;
+	return true;
+}
+
+void MappedTable::close()
+{
+	if (_data) {
+#if defined(_WIN32)
+		UnmapViewOfFile(_data);
+		CloseHandle(_mapping);
+		CloseHandle(_file);
+		_mapping = nullptr;
+		_file = nullptr;
+#else
+		munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+	}
+	_data = nullptr;
+	_size = 0;
+	_cells = nullptr;
+	_text = nullptr;
+	_textSize = 0;
+	_nRows = 0;
+	_cols.clear();
+	_decimalCols.clear();
+	_styles.clear();
+	_styleCodes.clear();
+	_options = TableOptions();
+}
+
+std::string MappedTable::format() const
+{
+	return format(_options.color);
 }
 
-/*static*/ std::string Table::colorize(Color c, const std::string& s)
+std::string MappedTable::format(ColorPolicy color) const
 {
-	if (c == Color::reset || !colorEnabled)
+	if (!_data)
+		return std::string();
+	Renderer::Scratch scratch;
+	renderTable(_options, Table::useColor(color), _cols, Source{ *this, &scratch.escapes }, (const Source*)nullptr, nullptr, nullptr, scratch);
+	return std::move(scratch.out);
+}
+
+void MappedTable::print() const
+{
+	Table::initConsole();
+	std::cout << format();
+}
+
+/*static*/ std::string Table::colorize(Color c, const std::string& s, ColorPolicy color)
+{
+	if (c == Color::reset || !useColor(color))
 		return s;
 
 	std::string in = colorCode(c);
@@ -611,4 +2855,252 @@ void Table::printHorizontalBorder(std::string& s, const std::vector<int>& innerC
 	return in + s + out;
 }
 
+/*static*/ ColorPolicy Table::detectColor(int fd)
+{
+	const char* noColor = std::getenv("NO_COLOR");
+	if (noColor && *noColor)
+		return ColorPolicy::never;
+#if defined(_WIN32)
+	return _isatty(fd) ? ColorPolicy::always : ColorPolicy::never;
+#else
+	return isatty(fd) ? ColorPolicy::always : ColorPolicy::never;
+#endif
+}
+
+/*static*/ bool Table::useColor(ColorPolicy color)
+{
+	switch (color) {
+	case ColorPolicy::always: return true;
+	case ColorPolicy::never: return false;
+	case ColorPolicy::global: return colorEnabled;
+	case ColorPolicy::automatic: {
+		// stdout doesn't change from a terminal to a file, so this is only checked once.
+		static const bool terminal = detectColor(1) == ColorPolicy::always;
+		return terminal;
+	}
+	}
+	return false;
+}
+
+// -- Views -- //
+
+namespace {
+
+// The leading number of the text, or NaN if there isn't one.
+double parseNumber(std::string_view text)
+{
+	char buf[64];
+	size_t n = std::min(text.size(), sizeof(buf) - 1);
+	memcpy(buf, text.data(), n);
+	buf[n] = 0;
+	char* end = nullptr;
+	double v = std::strtod(buf, &end);
+	return end == buf ? std::numeric_limits<double>::quiet_NaN() : v;
+}
+
+} // namespace
+
+struct TableView::Source {
+	const TableView& v;
+	Table::Source table;
+
+	int nRows() const { return int(v._rows.size()); }
+	CellRef cell(int r, int c) const {
+		const int row = v._rows[r];
+		if (row >= v._table._spilledRows)
+			return table.cell(row, c);
+		CellRef ref = table.resident(row, c);
+		if (ref.value < 0)
+			ref.text = table.cache->viewCells[size_t(r) * v._table._cols.size() + c];
+		return ref;
+	}
+	CellMeasure measure(int r, int c) const { return table.measure(v._rows[r], c); }
+	bool decimal(int c) const { return table.decimal(c); }
+};
+
+TableView::TableView(const Table& table) : _table(table)
+{
+	_rows.resize(table.nRows());
+	std::iota(_rows.begin(), _rows.end(), 0);
+}
+
+// Orders positions in _rows. Ties are broken by position, so sorts are stable
+// (even the partial sort) and can be chained to sort by several columns.
+template<class F>
+void TableView::order(int col, SortKey key, SortOrder order, F&& sort)
+{
+	assert(col >= 0 && col < _table.nCols());
+	SpillCache cache;
+	const Table::Source src{ _table, &cache };
+	const bool desc = order == SortOrder::descending;
+
+	std::vector<int> pos(_rows.size());
+	std::iota(pos.begin(), pos.end(), 0);
+	// The keys are read in table order, so each spilled segment is read once however
+	// the view is ordered.
+	std::vector<int> byRow;
+	if (_table.nSpilledRows() > 0) {
+		byRow = pos;
+		std::sort(byRow.begin(), byRow.end(), [this](int a, int b) { return _rows[a] < _rows[b]; });
+	}
+	const std::vector<int>& reads = byRow.empty() ? pos : byRow;
+
+	if (key == SortKey::numeric) {
+		// Parse once per row, not once per comparison. NaN (not a number) sorts last.
+		std::vector<double> keys(_rows.size());
+		for (int i : reads)
+			keys[i] = parseNumber(src.cell(_rows[i], col).text);
+
+		sort(pos, [&](int a, int b) {
+			double ka = keys[a], kb = keys[b];
+			if (std::isnan(ka) || std::isnan(kb)) {
+				if (std::isnan(ka) != std::isnan(kb))
+					return std::isnan(kb);
+				return a < b;
+			}
+			if (ka != kb)
+				return desc ? ka > kb : ka < kb;
+			return a < b;
+		});
+	}
+	else {
+		// Spilled text is only valid until the next segment is read, so it is copied.
+		std::vector<std::string_view> keys(_rows.size());
+		std::vector<std::string> spilled(_table.nSpilledRows() > 0 ? _rows.size() : 0);
+		for (int i : reads) {
+			keys[i] = src.cell(_rows[i], col).text;
+			if (_rows[i] < _table.nSpilledRows()) {
+				spilled[i] = keys[i];
+				keys[i] = spilled[i];
+			}
+		}
+
+		sort(pos, [&](int a, int b) {
+			int cmp = keys[a].compare(keys[b]);
+			if (cmp != 0)
+				return desc ? cmp > 0 : cmp < 0;
+			return a < b;
+		});
+	}
+
+	std::vector<int> rows(pos.size());
+	for (size_t i = 0; i < pos.size(); ++i)
+		rows[i] = _rows[pos[i]];
+	_rows.swap(rows);
+}
+
+TableView& TableView::sortBy(int col, SortKey key, SortOrder sortOrder)
+{
+	order(col, key, sortOrder, [](std::vector<int>& pos, const auto& less) {
+		std::sort(pos.begin(), pos.end(), less);
+	});
+	return *this;
+}
+
+TableView& TableView::topK(int col, int k, SortKey key, SortOrder sortOrder)
+{
+	k = std::clamp(k, 0, nRows());
+	order(col, key, sortOrder, [k](std::vector<int>& pos, const auto& less) {
+		std::partial_sort(pos.begin(), pos.begin() + k, pos.end(), less);
+		pos.resize(k);
+	});
+	return *this;
+}
+
+void TableView::reset()
+{
+	_rows.resize(_table.nRows());
+	std::iota(_rows.begin(), _rows.end(), 0);
+}
+
+void TableView::render(Renderer::Scratch& scratch, bool color) const
+{
+	// Rows are emitted in view order, so the spilled text of the view is read first,
+	// in table order, a segment at a time. (The output holds all of it anyway.)
+	SpillCache& spill = scratch.spill;
+	spill.viewData.clear();
+	spill.viewCells.clear();
+	if (_table.nSpilledRows() > 0) {
+		const size_t nCols = _table._cols.size();
+		const Table::Source src{ _table, &spill };
+		std::vector<int> pos;
+		for (size_t i = 0; i < _rows.size(); ++i) {
+			if (_rows[i] < _table.nSpilledRows())
+				pos.push_back(int(i));
+		}
+		std::sort(pos.begin(), pos.end(), [this](int a, int b) { return _rows[a] < _rows[b]; });
+
+		std::vector<std::pair<size_t, size_t>> spans(_rows.size() * nCols);	// into viewData
+		for (int i : pos) {
+			for (size_t c = 0; c < nCols; ++c) {
+				if (!_table._cols[c].visible)
+					continue;
+				const CellRef ref = src.cell(_rows[i], int(c));
+				if (ref.value >= 0)
+					continue;
+				spans[size_t(i) * nCols + c] = { spill.viewData.size(), ref.text.size() };
+				spill.viewData.append(ref.text);
+			}
+		}
+		spill.viewCells.resize(spans.size());
+		for (size_t i = 0; i < spans.size(); ++i)
+			spill.viewCells[i] = std::string_view(spill.viewData).substr(spans[i].first, spans[i].second);
+	}
+
+	if (_layoutFromTable) {
+		Table::Source table{ _table, &scratch.spill };
+		renderTable(_table._options, color, _table._cols, Source{ *this, table }, &table, nullptr, nullptr, scratch);
+	}
+	else {
+		renderTable(_table._options, color, _table._cols, Source{ *this, Table::Source{ _table, &scratch.spill } }, (const Source*)nullptr, nullptr, nullptr, scratch);
+	}
+}
+
+std::string TableView::format() const
+{
+	return format(_table._options.color);
+}
+
+std::string TableView::format(ColorPolicy color) const
+{
+	Renderer::Scratch scratch;
+	render(scratch, Table::useColor(color));
+	return std::move(scratch.out);
+}
+
+void TableView::print() const
+{
+	Table::initConsole();
+	std::cout << format();
+}
+
+// -- Renderer -- //
+
+Renderer::Renderer() : _scratch(std::make_unique<Scratch>()) {}
+Renderer::~Renderer() = default;
+Renderer::Renderer(Renderer&&) noexcept = default;
+Renderer& Renderer::operator=(Renderer&&) noexcept = default;
+
+const std::string& Renderer::render(const Table& table)
+{
+	const Table::Source src{ table, &_scratch->spill };
+	const FooterSource footer = src.footer(*_scratch);
+	renderTable(table._options, Table::useColor(_color.value_or(table._options.color)), table._cols, src, (const Table::Source*)nullptr, &footer, &table._stats, *_scratch);
+	return _scratch->out;
+}
+
+const std::string& Renderer::render(const TableView& view)
+{
+	view.render(*_scratch, Table::useColor(_color.value_or(view._table._options.color)));
+	return _scratch->out;
+}
+
+const std::string& Renderer::render(const MappedTable& table)
+{
+	_scratch->out.clear();
+	if (table.isOpen())
+		renderTable(table._options, Table::useColor(_color.value_or(table._options.color)), table._cols, MappedTable::Source{ table, &_scratch->escapes }, (const MappedTable::Source*)nullptr, nullptr, nullptr, *_scratch);
+	return _scratch->out;
+}
+
 }  // namespace ionic
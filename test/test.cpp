@@ -2,8 +2,31 @@
 #include "ionic/ionic.h"
 
 #include <iostream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cmath>
+#include <memory_resource>
 #include <assert.h>
 
+// Counts every allocation, so tests can check that a render path doesn't allocate.
+static std::atomic<long> gAllocations{ 0 };
+
+void* operator new(std::size_t size)
+{
+    ++gAllocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
 void PrintRuler(int w)
 {
     for (int i = 0; i < w; i++) {
@@ -255,6 +278,841 @@ bool IonicTest::test()
         std::string result = t.format();
         printf("2 col result: \n%s\n", result.c_str());
         TEST(result == "AA | Hello\nBB | World\n");
+
+        t.setCell(1, 1, { Color::red }, { Alignment::right });
+        result = t.format();
+        TEST(result == "AA | Hello\nBB | \033[31mWorld\033[0m\n");
+    }
+    {
+        // Styles: 256 color and RGB, attributes, and the palette they're interned in.
+        Style style;
+        TEST(styleCode(style).empty());
+        style.fg = Color::red;
+        TEST(styleCode(style) == "\033[31m");
+        style.fg = TermColor::index256(208);
+        style.bg = Color::blue;
+        style.bold = true;
+        TEST(styleCode(style) == "\033[1;38;5;208;44m");
+        style.fg = TermColor::rgb(1, 2, 3);
+        style.bg = TermColor();
+        style.bold = false;
+        style.underline = true;
+        TEST(styleCode(style) == "\033[4;38;2;1;2;3m");
+
+        ionic::TableOptions options;
+        options.outerBorder = false;
+        options.innerHDivider = false;
+        options.innerVDivider = false;
+        ionic::Table t(options);
+        for (int i = 0; i < 100; ++i)
+            t.addRow({ "a", i });
+        const int nDefault = t.nStyles();
+        style.alignment = Alignment::right;
+        t.setColumn(0, style);
+        for (int i = 0; i < 100; ++i)
+            t.setCell(i, 1, { Color::green }, {});
+        TEST(t.nStyles() == nDefault + 2);
+        TEST(t.style(7, 0) == style);
+        TEST(t.style(7, 1).fg == TermColor(Color::green));
+        TEST(t.style(7, 1).alignment == Alignment::decimal);
+
+        ionic::Table small(options);
+        small.addRow({ "ab" });
+        small.setCell(0, 0, style);
+        TEST(small.format() == "\033[4;38;2;1;2;3mab\033[0m\n");
+    }
+    {
+        TEST(Table::formatValue(-42, ValueFormat::automatic, 2) == "-42");
+        TEST(Table::formatValue(0.1, ValueFormat::automatic, 2) == "0.1");
+        TEST(Table::formatValue(UINT64_MAX, ValueFormat::automatic, 2) == "18446744073709551615");
+        TEST(Table::formatValue(2.6, ValueFormat::integer, 2) == "3");
+        TEST(Table::formatValue(3.14159, ValueFormat::floating, 3) == "3.142");
+        TEST(Table::formatValue(7, ValueFormat::floating, 1) == "7.0");
+        TEST(Table::formatValue(512, ValueFormat::bytes, 2) == "512 B");
+        TEST(Table::formatValue(1536, ValueFormat::bytes, 2) == "1.50 KiB");
+        TEST(Table::formatValue(0.00035, ValueFormat::duration, 2) == "350.00 us");
+        TEST(Table::formatValue(90.0, ValueFormat::duration, 1) == "1.5 min");
+        TEST(Table::formatValue("text", ValueFormat::floating, 1) == "text");
+    }
+    {
+        // Numbers line up on the decimal point.
+        ionic::TableOptions options;
+        options.outerBorder = false;
+        options.innerHDivider = false;
+        options.maxWidth = 40;
+        ionic::Table t(options);
+        t.addRow({ "a", 1.5 });
+        t.addRow({ "b", 12 });
+        t.addRow({ "c", 0.25 });
+        TEST(t.format() == "a |  1.5 \nb | 12   \nc |  0.25\n");
+
+        ionic::Table d(options);
+        d.setColumnFormat({ {ColType::flex}, {ColType::flex, 0, ValueFormat::duration, 1} });
+        d.addRow({ "fast", 0.0125 });
+        d.addRow({ "slow", 2.5 });
+        TEST(d.format() == "fast | 12.5 ms\nslow |  2.5 s \n");
+
+        // Only columns with decimal aligned cells are scanned for them.
+        ionic::Table f(options);
+        f.setColumnFormat({ {ColType::fixed, 6}, {ColType::fixed, 6} });
+        f.addRow({ "a", "1.5" });
+        f.addRow({ "b", "12" });
+        TEST(f._decimalCols.empty());
+        f.setColumn(1, {}, Alignment::decimal);
+        TEST(f._decimalCols == std::vector<char>({ 0, 1 }));
+        TEST(f.format() == "a      |    1.5\nb      |   12  \n");
+        f.addRow({ "c", 0.25 });
+        TEST(f._decimalCols == std::vector<char>({ 0, 1 }));
+
+        // A Value keeps a temporary string, so a row can be built up before it is added.
+        std::vector<Value> row;
+        row.push_back(std::string(20, 'x') + "tmp");
+        row.push_back(std::to_string(3) + ".5");
+        std::vector<Value> copy = row;
+        row.clear();
+        ionic::Table v(options);
+        v.addRow(copy);
+        TEST(v.format() == "xxxxxxxxxxxxxxxxxxxxtmp | 3.5\n");
+    }
+    {
+        ionic::TableOptions options;
+        options.outerBorder = false;
+        options.innerHDivider = false;
+        options.maxWidth = 40;
+        ionic::Table t(options);
+        t.addRow({ "/index", "12" });
+        t.addRow({ "/login", "250.5" });
+        t.addRow({ "/a", "n/a" });
+        t.addRow({ "/search", "90" });
+        t.addRow({ "/b", "250.5" });
+
+        ionic::TableView slowest(t);
+        slowest.topK(1, 3);
+        TEST(slowest.rows() == std::vector<int>({ 1, 4, 3 }));   // ties stay in table order
+        TEST(slowest.format() == "/login  | 250.5\n/b      | 250.5\n/search | 90   \n");
+
+        ionic::TableView byName(t);
+        byName.sortBy(0);
+        TEST(byName.rows() == std::vector<int>({ 2, 4, 0, 1, 3 }));
+        byName.sortBy(1, SortKey::numeric);
+        TEST(byName.rows() == std::vector<int>({ 0, 3, 4, 1, 2 }));  // "n/a" last
+
+        ionic::TableView few(t);
+        few.topK(0, 1, SortKey::lexical, SortOrder::ascending);
+        TEST(few.format() == "/a | n/a\n");
+        few.setLayoutFromTable(true);
+        TEST(few.format() == "/a      | n/a  \n");
+        few.reset();
+        TEST(few.nRows() == t.nRows());
+    }
+    {
+        // Row budget: only the head and tail are rendered.
+        ionic::TableOptions options;
+        options.maxWidth = 40;
+        options.headRows = 2;
+        options.tailRows = 1;
+        ionic::Table t(options);
+        for (int i = 0; i < 1000; ++i)
+            t.addRow({ "endpoint " + std::to_string(i), i });
+        t.addRow({ "the last endpoint", 12345 });
+        std::string result = t.format();
+        TEST(result ==
+            "+-------------------+-------+\n"
+            "| endpoint 0        |     0 |\n"
+            "+-------------------+-------+\n"
+            "| endpoint 1        |     1 |\n"
+            "+-------------------+-------+\n"
+            "| ... 998 more rows         |\n"
+            "+-------------------+-------+\n"
+            "| the last endpoint | 12345 |\n"
+            "+-------------------+-------+\n");
+
+        options.headRows = 0;
+        options.tailRows = 0;
+        ionic::Table none(options);
+        none.addRow({ "a" });
+        none.addRow({ "b" });
+        TEST(none.format() == "+-----------------+\n| ... 2 more rows |\n+-----------------+\n");
+        options.headRows = 2;
+        ionic::Table all(options);
+        all.addRow({ "a" });
+        all.addRow({ "b" });
+        TEST(all.format() == "+---+\n| a |\n+---+\n| b |\n+---+\n");
+
+        // The line widens the table for the count, or is shortened if the table can't widen.
+        options.headRows = 1;
+        options.tailRows = 1;
+        options.innerHDivider = false;
+        ionic::Table small(options);
+        for (int i = 0; i < 50; ++i)
+            small.addRow({ "a", "b" });
+        TEST(small.format() ==
+            "+---+--------------+\n"
+            "| a | b            |\n"
+            "| ... 48 more rows |\n"
+            "| a | b            |\n"
+            "+---+--------------+\n");
+        options.maxWidth = 10;
+        ionic::Table narrow(options);
+        for (int i = 0; i < 50; ++i)
+            narrow.addRow({ "a", "b" });
+        TEST(narrow.format() ==
+            "+---+---+\n"
+            "| a | b |\n"
+            "| +48   |\n"
+            "| a | b |\n"
+            "+---+---+\n");
+    }
+    {
+        // Hidden columns are skipped; with dropWidth, low priority columns are dropped to fit.
+        ionic::TableOptions options;
+        options.maxWidth = 40;
+        options.innerHDivider = false;
+        ionic::Table t(options);
+        t.addRow({ "id", "name", "description" });
+        t.addRow({ "1", "ionic", "a table formatter" });
+        t.setColumnVisible(2, false);
+        TEST(t.format() ==
+            "+----+-------+\n"
+            "| id | name  |\n"
+            "| 1  | ionic |\n"
+            "+----+-------+\n");
+        TEST(t.nCols() == 3);
+        t.setColumnVisible(2, true);
+        TEST(t.column(2).visible);
+
+        // 3 columns at least 10 wide don't fit in 30, so the lowest priority (name) is dropped.
+        options.maxWidth = 30;
+        options.dropWidth = 10;
+        ionic::Table narrow(options);
+        narrow.addRow({ "id", "name", "description" });
+        narrow.addRow({ "1", "ionic", "a table formatter" });
+        narrow.setColumnPriority(0, 1);
+        narrow.setColumnPriority(2, 2);
+        TEST(narrow.format() ==
+            "+----+-------------------+\n"
+            "| id | description       |\n"
+            "| 1  | a table formatter |\n"
+            "+----+-------------------+\n");
+    }
+    {
+        // Once a Renderer's buffers have grown, re-rendering doesn't allocate.
+        ionic::TableOptions options;
+        options.maxWidth = 60;
+        ionic::Table t(options);
+        AddVar4Rows(t);
+        t.addRow({ "3", "Multi\nLine", "It was a bright cold day in April, and the clocks were striking thirteen." });
+        t.setCell(1, 2, { Color::red }, { Alignment::right });
+
+        ionic::Renderer renderer;
+        std::string expected = t.format();
+        TEST(renderer.render(t) == expected);
+        long before = gAllocations;
+        for (int i = 0; i < 10; ++i)
+            renderer.render(t);
+        TEST(gAllocations == before);
+        TEST(renderer.render(t) == expected);
+
+        ionic::TableView view(t);
+        view.sortBy(1, SortKey::lexical, SortOrder::descending);
+        std::string viewExpected = view.format();
+        TEST(renderer.render(view) == viewExpected);
+        before = gAllocations;
+        renderer.render(view);
+        TEST(gAllocations == before);
+    }
+    {
+        // Tables over their memory budget spill text to disk, and render the same.
+        ionic::TableOptions options;
+        options.maxWidth = 60;
+        ionic::Table memory(options);
+        options.memoryBudget = 1000;
+        ionic::Table spilled(options);
+        memory.addFooter("sum", { Aggregate::none, Aggregate::sum, Aggregate::sum });
+        spilled.addFooter("sum", { Aggregate::none, Aggregate::sum, Aggregate::sum });
+        for (int i = 0; i < 500; ++i) {
+            std::string text = "row " + std::to_string(i * 7919 % 500) + (i % 3 ? " a longer cell\nwith two lines" : "");
+            memory.addRow({ text, i, 0.5 * i });
+            spilled.addRow({ text, i, 0.5 * i });
+        }
+        TEST(spilled.nSpilledRows() > 400);
+        TEST(spilled.format() == memory.format());
+        // The layout doesn't read the spilled text, so a render reads each segment once.
+        spilled.setColumn(1, {}, Alignment::decimal);
+        memory.setColumn(1, {}, Alignment::decimal);
+        spilled.resetStats();
+        TEST(spilled.format() == memory.format());
+#if IONIC_STATS
+        TEST(spilled.stats().spillReads == spilled._segments.size());
+#endif
+
+        ionic::TableView a(memory), b(spilled);
+        a.sortBy(0, SortKey::lexical, SortOrder::descending);
+        b.sortBy(0, SortKey::lexical, SortOrder::descending);
+        TEST(a.rows() == b.rows());
+        TEST(a.format() == b.format());
+        // Sorting and rendering a view read each segment once, whatever the view's order.
+        spilled.resetStats();
+        a.sortBy(1, SortKey::numeric);
+        b.sortBy(1, SortKey::numeric);
+        TEST(a.rows() == b.rows());
+        TEST(a.format() == b.format());
+#if IONIC_STATS
+        TEST(spilled.stats().spillReads == 2 * spilled._segments.size());
+#endif
+
+        ionic::Renderer renderer;
+        TEST(renderer.render(spilled) == memory.format());
+
+        std::string path = (std::filesystem::temp_directory_path() / "ionic_spill.snap").string();
+        TEST(spilled.save(path));
+        ionic::MappedTable m;
+        TEST(m.open(path));
+        ionic::Table copy = memory;
+        copy.clearFooters();
+        TEST(m.format() == copy.format());
+        m.close();
+        std::filesystem::remove(path);
+    }
+    {
+        // Snapshots render the same as the table they were saved from.
+        ionic::TableOptions options;
+        options.maxWidth = 40;
+        options.innerHDivider = false;
+        ionic::Table t(options);
+        AddVar4Rows(t);
+        t.addRow({ "3", "Multi\nLine", "It was a bright cold day in April, and the clocks were striking thirteen." });
+        t.addRow({ "4", "", Table::colorize(Color::red, "Escapes take no width, wrapped or not", ColorPolicy::always) });
+        t.setCell(1, 2, { Color::red }, { Alignment::right });
+        Style rgb;
+        rgb.fg = TermColor::rgb(255, 128, 0);
+        rgb.bold = true;
+        t.setCell(3, 1, rgb);
+
+        std::string path = (std::filesystem::temp_directory_path() / "ionic_test.snap").string();
+        TEST(t.save(path));
+
+        ionic::MappedTable m;
+        TEST(m.open(path));
+        TEST(m.nRows() == t.nRows());
+        TEST(m.nCols() == t.nCols());
+        TEST(m.options().maxWidth == 40);
+        TEST(m.format() == t.format());
+
+        m.close();
+        TEST(!m.isOpen());
+        TEST(m.format().empty());
+        std::filesystem::remove(path);
+        TEST(!m.open(path));
+    }
+    {
+        // Sampled widths ignore the rare wide cell; exact widths don't.
+        ionic::TableOptions options;
+        options.maxWidth = 80;
+        ionic::Table exact(options);
+        options.widthSampleRows = 50;
+        options.widthSampleQuantile = 0.9;
+        ionic::Table sampled(options);
+        for (int i = 0; i < 1000; ++i) {
+            std::string text = (i % 100 == 7) ? std::string(30, 'x') : "aaaaa";
+            exact.addRow({ text });
+            sampled.addRow({ text });
+        }
+        std::string e = exact.format();
+        std::string s = sampled.format();
+        TEST(e.substr(0, e.find('\n')) == "+" + std::string(32, '-') + "+");
+        TEST(s.substr(0, s.find('\n')) == "+" + std::string(7, '-') + "+");
+    }
+    {
+        // Concurrent producers, merged before formatting.
+        ionic::Table t;
+        t.addFooter("", { Aggregate::max, Aggregate::sum });
+        std::vector<std::thread> threads;
+        for (int p = 0; p < 4; ++p) {
+            threads.emplace_back([&t, p]() {
+                ionic::Table::Appender appender(t, 64);
+                for (int i = 0; i < 1000; ++i)
+                    appender.addRow({ std::to_string(p), std::to_string(i) + "  \r\n" });
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        TEST(t.nRows() == 0);
+        t.merge();
+        TEST(t.nRows() == 4000);
+        TEST(t.nCols() == 2);
+
+        int next[4] = { 0, 0, 0, 0 };
+        for (int r = 0; r < t.nRows(); ++r) {
+            int p = std::stoi(std::string(t._rows[r][0].text));
+            TEST(std::string_view(t._rows[r][1].text) == std::to_string(next[p]));
+            TEST(t._rows[r][1].desiredWidth == int(t._rows[r][1].text.size()));
+            ++next[p];
+        }
+        // The aggregates from each producer are combined on merge.
+        TEST(t.aggregate(1, Aggregate::count) == 4000);
+        TEST(t.aggregate(1, Aggregate::sum) == 4 * 999 * 1000 / 2);
+        TEST(t.aggregate(0, Aggregate::max) == 3);
+    }
+    {
+        // Color policies are per render, so output for a terminal and for a log can be
+        // rendered at the same time. (Views don't collect stats, so this holds with
+        // IONIC_STATS too.)
+        ionic::TableOptions options;
+        options.maxWidth = 20;
+        options.outerBorder = false;
+        options.innerHDivider = false;
+        options.color = ColorPolicy::never;
+        ionic::Table t(options);
+        t.addRow({ "AA", "Hello" });
+        t.setCell(0, 1, { Color::red }, {});
+        const std::string plain = "AA | Hello\n";
+        const std::string colored = "AA | \033[31mHello\033[0m\n";
+        TEST(t.format() == plain);
+        TEST(t.format(ColorPolicy::always) == colored);
+
+        ionic::TableView view(t);
+        std::atomic<int> mismatches{ 0 };
+        std::thread terminal([&]() {
+            for (int i = 0; i < 200; ++i)
+                mismatches += view.format(ColorPolicy::always) != colored;
+        });
+        std::thread log([&]() {
+            for (int i = 0; i < 200; ++i)
+                mismatches += view.format(ColorPolicy::never) != plain;
+        });
+        terminal.join();
+        log.join();
+        TEST(mismatches == 0);
+
+        TEST(Table::colorize(Color::red, "x", ColorPolicy::never) == "x");
+        TEST(Table::colorize(Color::red, "x", ColorPolicy::always) == "\033[31mx\033[0m");
+        TEST(Table::detectColor(-1) == ColorPolicy::never);
+    }
+    {
+        // Truncated columns are one line per row, cut to the width rather than wrapped.
+        ionic::TableOptions options;
+        options.maxWidth = 30;
+        options.innerHDivider = false;
+        ionic::Table t(options);
+        Table::Column message;
+        message.truncate = true;
+        t.setColumnFormat({ { ColType::fixed, 5 }, message });
+        t.addRow({ "12:00", "connection reset by peer while reading the response" });
+        t.addRow({ "12:01", "retry\nsecond line" });
+        t.addRow({ "12:02", std::string(100000, 'x') });
+        TEST(t.format() ==
+            "+-------+--------------------+\n"
+            "| 12:00 | connection reset.. |\n"
+            "| 12:01 | retry              |\n"
+            "| 12:02 | xxxxxxxxxxxxxxxx.. |\n"
+            "+-------+--------------------+\n");
+
+        // They're as wide as the first lines, which are all they show, bounded or not.
+        for (int maxRows : { 0, 5 }) {
+            ionic::TableOptions narrow = options;
+            narrow.maxRows = maxRows;
+            ionic::Table first(narrow);
+            first.setColumnFormat({ Table::Column(), message });
+            first.addRow({ "1", "short\n" + std::string(55, 'x') });
+            TEST(first.format() ==
+                "+---+-------+\n"
+                "| 1 | short |\n"
+                "+---+-------+\n");
+        }
+    }
+    {
+        // Dictionary columns store each distinct value once, and render the same.
+        ionic::TableOptions options;
+        options.maxWidth = 40;
+        ionic::Table plain(options);
+        ionic::Table encoded(options);
+        Table::Column status;
+        status.dictionary = true;
+        encoded.setColumnFormat({ status, Table::Column() });
+        static const char* kStatus[] = { "ok", "not found", "internal server error, retrying later" };
+        for (int i = 0; i < 300; ++i) {
+            plain.addRow({ kStatus[i % 3], std::to_string(i) });
+            encoded.addRow({ kStatus[i % 3], std::to_string(i) });
+        }
+        TEST(encoded._dictionaries[0]->values.size() == 3);
+        TEST(encoded._rows[42][0].text.empty());
+        TEST(encoded.format() == plain.format());
+
+        ionic::TableView view(encoded);
+        view.sortBy(0, SortKey::lexical, SortOrder::ascending);
+        TEST(view.format().find("| internal server") != std::string::npos);
+    }
+    {
+        // addRows() prepares rows in parallel, with exactly the result of addRow().
+        ionic::TableOptions options;
+        options.maxWidth = 60;
+        options.memoryBudget = 20000;
+        Table::Column host;
+        host.dictionary = true;
+        ionic::Table one(options), bulk(options), values(options), plain(options);
+        for (Table* t : { &one, &bulk, &values, &plain })
+            t->setColumnFormat({ host, Table::Column(), Table::Column() });
+        for (Table* t : { &one, &bulk, &values })
+            t->addFooter("total", { Aggregate::none, Aggregate::none, Aggregate::sum });
+
+        std::vector<std::vector<std::string>> rows;
+        std::vector<std::vector<Value>> valueRows;
+        for (int i = 0; i < 3000; ++i) {
+            rows.push_back({ "host-" + std::to_string(i % 7), " line\r\none " + std::to_string(i) + "  ", std::to_string(i * 0.1) });
+            valueRows.push_back({ rows.back()[0], rows.back()[1], i * 0.1 });
+            one.addRow(rows.back());
+        }
+        bulk.addRows(rows, 4);
+        values.addRows(valueRows, 4);
+        plain.addRows(valueRows, 4);
+
+        TEST(bulk.nRows() == one.nRows());
+        TEST(bulk.nSpilledRows() == one.nSpilledRows());
+        TEST(bulk._dictionaries[0]->values == one._dictionaries[0]->values);
+        for (int r = 0; r < one.nRows(); ++r) {
+            for (int c = 0; c < one.nCols(); ++c) {
+                const Table::Cell& a = one._rows[r][c];
+                const Table::Cell& b = bulk._rows[r][c];
+                TEST(a.text == b.text && a.desiredWidth == b.desiredWidth && a.nLines == b.nLines && a.value == b.value);
+            }
+        }
+        for (Aggregate agg : { Aggregate::count, Aggregate::sum, Aggregate::min, Aggregate::max })
+            TEST(bulk.aggregate(2, agg) == one.aggregate(2, agg));
+        TEST(bulk.format() == one.format());
+        TEST(values.aggregate(2, Aggregate::count) == 3000);
+        TEST(values.aggregate(1, Aggregate::count) == 0);
+        TEST(plain.aggregate(2, Aggregate::count) == 0);      // no footer, so nothing is kept
+    }
+    {
+        // A table's storage comes from its memory resource; here an arena that can't grow.
+        static char buffer[1 << 20];
+        std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+        ionic::TableOptions options;
+        options.maxWidth = 60;
+        ionic::Table t(options, &arena);
+        const std::string text = "a cell too long to be stored in the string itself";
+        t.addRow({ "0", text, 0.5 });
+        const long before = gAllocations;
+        for (int i = 1; i < 1500; ++i) {
+            const std::string n = std::to_string(i);
+            t.addRow({ n, text, i + 0.5 });
+        }
+        TEST(gAllocations == before);
+
+        std::vector<std::string> row = { "merged", text, "1" };
+        {
+            ionic::Table::Appender appender(t);
+            appender.addRow(row);
+        }
+        t.merge();
+        TEST(t.nRows() == 1501);
+        TEST(t._rows[1500][1].text == text.c_str());
+        TEST(t._rows[1500][1].text.get_allocator().resource() == &arena);
+
+        ionic::Table plain(options);
+        for (int r = 0; r < t.nRows(); ++r) {
+            for (int c = 0; c < t.nCols(); ++c)
+                row[c] = t._rows[r][c].text;
+            plain.addRow(row);
+        }
+        plain.setColumn(2, {}, Alignment::decimal);
+        t.setColumn(2, {}, Alignment::decimal);
+        TEST(t.format() == plain.format());
+    }
+    {
+        // Box drawing borders: corners, tees and crossings, each a multibyte glyph.
+        auto box = [](std::string_view ascii) {
+            // ASCII stand-ins for the light glyphs, so the expected tables are readable.
+            static const std::pair<char, const char*> kGlyphs[] = {
+                { '<', "\xe2\x94\x8c" }, { 'v', "\xe2\x94\xac" }, { '>', "\xe2\x94\x90" },
+                { '(', "\xe2\x94\x9c" }, { '+', "\xe2\x94\xbc" }, { ')', "\xe2\x94\xa4" },
+                { '[', "\xe2\x95\x9e" }, { '#', "\xe2\x95\xaa" }, { ']', "\xe2\x95\xa1" },
+                { '{', "\xe2\x94\x94" }, { '^', "\xe2\x94\xb4" }, { '}', "\xe2\x94\x98" },
+                { '-', "\xe2\x94\x80" }, { '=', "\xe2\x95\x90" }, { '|', "\xe2\x94\x82" },
+            };
+            std::string s;
+            for (char ch : ascii) {
+                auto it = std::find_if(std::begin(kGlyphs), std::end(kGlyphs), [ch](const auto& g) { return g.first == ch; });
+                if (it == std::end(kGlyphs))
+                    s += ch;
+                else
+                    s += it->second;
+            }
+            return s;
+        };
+        ionic::TableOptions options;
+        options.maxWidth = 40;
+        options.borderStyle = BorderStyle::light;
+        ionic::Table t(options);
+        t.addFooter("sum", { Aggregate::none, Aggregate::sum });
+        t.addRow({ "a", 1 });
+        t.addRow({ "b", 2 });
+        TEST(t.format() == box(
+            "<-----v--->\n"
+            "| a   | 1 |\n"
+            "(-----+---)\n"
+            "| b   | 2 |\n"
+            "[=====#===]\n"
+            "| sum | 3 |\n"
+            "{-----^---}\n"));
+
+        options.outerBorder = false;
+        ionic::Table inner(options);
+        inner.addRow({ "a", "b" });
+        inner.addRow({ "c", "d" });
+        TEST(inner.format() == box(
+            "a | b\n"
+            "--+---\n"
+            "c | d\n"));
+
+        std::string path = (std::filesystem::temp_directory_path() / "ionic_border.snap").string();
+        TEST(inner.save(path));
+        {
+            ionic::MappedTable mapped;
+            TEST(mapped.open(path));
+            TEST(mapped.format() == inner.format());
+        }
+        std::filesystem::remove(path);
+    }
+    {
+        // Escape sequences in the text take no width; wrapped lines carry them on.
+        ionic::TableOptions options;
+        options.maxWidth = 24;
+        options.innerHDivider = false;
+        ionic::Table t(options);
+        Table::Column cut;
+        cut.truncate = true;
+        t.setColumnFormat({ Table::Column(), Table::Column(), cut });
+        t.addRow({ "a", Table::colorize(Color::red, "Hello", ColorPolicy::always), "\033[1mbold and long\033[0m" });
+        t.addRow({ "b", "\033[32mthe quick brown fox\033[0m", "x" });
+        TEST(t._rows[0][1].desiredWidth == 5);
+        TEST(t._rows[0][1].escapes >= 0 && t._rows.escapes(0, t._rows[0][1].escapes).escapes.size() == 2);
+        TEST(t._rows[0][0].escapes == -1);
+        TEST(t.format() ==
+            "+---+--------+---------+\n"
+            "| a | \033[31mHello\033[0m \033[0m | \033[1mbold ..\033[0m |\n"
+            "| b | \033[32mthe   \033[0m | x       |\n"
+            "|   | \033[32mquick \033[0m |         |\n"
+            "|   | \033[32mbrown \033[0m |         |\n"
+            "|   | \033[32mfox\033[0m   \033[0m |         |\n"
+            "+---+--------+---------+\n");
+
+        Table::Escapes escapes;
+        TEST(!Table::findEscapes("plain", escapes));
+        TEST(Table::findEscapes("a\033[38;5;208mb\033[0mc", escapes));
+        TEST(escapes.escapes.size() == 2 && escapes.escapes[0].size == 11 && escapes.escapes[1].before == 11);
+        TEST(escapes.visibleWidth(0, 18) == 3);
+
+        // Dictionary values keep theirs in the dictionary, and other cells in their row
+        // segment, which a bounded table drops with the rows.
+        ionic::TableOptions boundedOptions = options;
+        boundedOptions.maxRows = 2;
+        ionic::Table bounded(boundedOptions);
+        Table::Column dict;
+        dict.dictionary = true;
+        bounded.setColumnFormat({ dict, Table::Column() });
+        for (int i = 0; i < 100; ++i)
+            bounded.addRow({ "\033[1mkey\033[0m", "\033[32m" + std::to_string(i) + "\033[0m" });
+        TEST(bounded._dictionaries[0]->escapes.size() == 1);
+        TEST(bounded.format() ==
+            "+-----+----+\n"
+            "| \033[1mkey\033[0m\033[0m | \033[32m98\033[0m\033[0m |\n"
+            "| \033[1mkey\033[0m\033[0m | \033[32m99\033[0m\033[0m |\n"
+            "+-----+----+\n");
+
+        // Decimal alignment and footer labels measure what is visible too.
+        ionic::Table decimal(options);
+        decimal.addFooter(Table::colorize(Color::red, "sum", ColorPolicy::always), { Aggregate::none, Aggregate::sum });
+        decimal.addRow({ "a", Table::colorize(Color::red, "1.5", ColorPolicy::always) });
+        decimal.addRow({ "b", "12.25" });
+        decimal.setColumn(1, {}, Alignment::decimal);
+        TEST(decimal.format(ColorPolicy::never) ==
+            "+-----+-------+\n"
+            "| a   |  \033[31m1.5\033[0m \033[0m |\n"
+            "| b   | 12.25 |\n"
+            "+=====+=======+\n"
+            "| \033[31msum\033[0m\033[0m | 12.25 |\n"
+            "+-----+-------+\n");
+    }
+    {
+        // A bounded table keeps the last maxRows rows, and lays them out like a table of just those.
+        ionic::TableOptions options;
+        options.maxWidth = 60;
+        options.innerHDivider = false;
+        ionic::TableOptions bounded = options;
+        bounded.maxRows = 5;
+        ionic::Table t(bounded);
+        std::vector<std::vector<Value>> added;
+        int mismatches = 0;
+        for (int i = 0; i < 3000; ++i) {
+            double number = (i % 11) * ((i % 3) ? 1.25 : 1000.0);
+            added.push_back({ std::to_string(i), std::string(size_t(i * 7 % 13 + 1), 'x'), number });
+            t.addRow(added.back());
+            if (i == 1500)
+                t.setColumn(1, {}, Alignment::decimal);   // the rows so far
+
+            ionic::Table last(options);
+            const int first = std::max(0, i - 4);
+            for (int r = first; r <= i; ++r) {
+                last.addRow(added[r]);
+                if (r <= 1500 && i >= 1500)
+                    last.setCell(r - first, 1, {}, Alignment::decimal);
+            }
+            mismatches += t.format() != last.format();
+        }
+        TEST(mismatches == 0);
+        TEST(t.nRows() == 5);
+        TEST(t._rows.size() == 5);
+        TEST(t._maxima[1].width.q.size() <= 5);
+
+        // Footers still count every row added.
+        ionic::Table counted(bounded);
+        counted.addFooter("", { Aggregate::count });
+        for (int i = 0; i < 100; ++i)
+            counted.addRow({ i });
+        TEST(counted.nRows() == 5 && counted.aggregate(0, Aggregate::count) == 100);
+    }
+    {
+        // Snapshots share the rows, and render on another thread while rows are added.
+        ionic::TableOptions options;
+        options.maxWidth = 40;
+        options.innerHDivider = false;
+        options.memoryBudget = 20000;
+        ionic::Table t(options);
+        for (int i = 0; i < 1500; ++i)
+            t.addRow({ std::to_string(i), "row " + std::to_string(i) });
+        std::shared_ptr<const Table> first = t.snapshot();
+        const std::string before = first->format();
+        TEST(before == t.format());
+
+        Style red;
+        red.fg = Color::red;
+        t.setCell(3, 1, red);
+        t.addRow({ "1500", "row 1500" });
+        TEST(first->nRows() == 1500);
+        TEST(first->style(3, 1) != red);
+        TEST(first->format() == before);
+
+        std::mutex mutex;
+        std::shared_ptr<const Table> latest = first;
+        std::atomic<bool> done{ false };
+        std::atomic<int> mismatches{ 0 };
+        std::thread renderer([&]() {
+            while (!done) {
+                std::shared_ptr<const Table> snap;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    snap = latest;
+                }
+                // All of the snapshot's rows, and none added since.
+                const std::string text = snap->format(ColorPolicy::never);
+                const int n = snap->nRows();
+                mismatches += text.find("| " + std::to_string(n - 1) + " ") == std::string::npos
+                    || text.find("| " + std::to_string(n) + " ") != std::string::npos;
+            }
+        });
+        for (int i = 1501; i < 4000; ++i) {
+            t.addRow({ std::to_string(i), "row " + std::to_string(i) });
+            if (i % 100 == 0) {
+                std::shared_ptr<const Table> snap = t.snapshot();
+                std::lock_guard<std::mutex> lock(mutex);
+                latest = snap;
+            }
+        }
+        done = true;
+        renderer.join();
+        TEST(mismatches == 0);
+        TEST(t.nSpilledRows() > first->nSpilledRows());
+        TEST(first->format() == before);
+    }
+    {
+        // The dictionaries and escape indices are shared with snapshots too, and copied
+        // only when the table changes them.
+        ionic::TableOptions options;
+        options.maxRows = 3;
+        ionic::Table t(options);
+        Table::Column status;
+        status.dictionary = true;
+        t.setColumnFormat({ status, Table::Column() });
+        t.addRow({ "ok", Table::colorize(Color::green, "up", ColorPolicy::always) });
+        t.addRow({ "ok", "plain" });
+        std::shared_ptr<const Table> snap = t.snapshot();
+        const std::string before = snap->format();
+        TEST(&*snap->_dictionaries[0] == &*t._dictionaries[0]);
+        TEST(&snap->_rows.escapes(0, 0) == &t._rows.escapes(0, 0));
+
+        t.addRow({ "ok", "again" });      // no new value, so the dictionary is still shared
+        TEST(&*snap->_dictionaries[0] == &*t._dictionaries[0]);
+        t.addRow({ "down", Table::colorize(Color::red, "gone", ColorPolicy::always) });
+        TEST(&*snap->_dictionaries[0] != &*t._dictionaries[0]);
+        TEST(snap->_dictionaries[0]->values.size() == 1 && t._dictionaries[0]->values.size() == 2);
+        TEST(snap->format() == before);
+    }
+    {
+        // Footers summarize the numbers in each column, without another pass over the rows.
+        ionic::TableOptions options;
+        options.maxWidth = 40;
+        options.innerHDivider = false;
+        ionic::Table t(options);
+        t.addFooter("total", { Aggregate::none, Aggregate::sum, Aggregate::sum });
+        t.addFooter("mean", { Aggregate::none, Aggregate::mean, Aggregate::max });
+        t.addRow({ "a", 1, 2.5 });
+        t.addRow({ "b", 2, "x" });
+        t.addRow({ "c", "3", 0.25 });
+        t.addRow({ "d", "inf", "nan" });     // not numbers
+        TEST(t.aggregate(1, Aggregate::count) == 3);
+        TEST(t.aggregate(2, Aggregate::min) == 0.25);
+        TEST(std::isnan(t.aggregate(0, Aggregate::mean)));
+        TEST(t.format() ==
+            "+-------+------+------+\n"
+            "| a     | 1    | 2.5  |\n"
+            "| b     | 2    | x    |\n"
+            "| c     | 3    | 0.25 |\n"
+            "| d     | inf  | nan  |\n"
+            "+=======+======+======+\n"
+            "| total | 6    | 2.75 |\n"
+            "| mean  | 2.00 | 2.5  |\n"
+            "+-------+------+------+\n");
+
+        // A footer added after rows catches up with them; clearing footers stops the parsing.
+        ionic::Table late;
+        late.addRow({ "1" });
+        late.addFooter("s", { Aggregate::sum });
+        late.addRow({ "2" });
+        TEST(late.aggregate(0, Aggregate::sum) == 3);
+        late.clearFooters();
+        TEST(!late.aggregating());
+        late.addRow({ "4" });
+        TEST(late.aggregate(0, Aggregate::count) == 0);
+        late.addFooter("s", { Aggregate::sum });
+        TEST(late.aggregate(0, Aggregate::sum) == 7);
+    }
+    {
+        ionic::TableOptions options;
+        options.outerBorder = false;
+        options.innerHDivider = false;
+        options.maxWidth = 11;
+        ionic::Table t(options);
+        t.addRow({ "AA", "Hello" });
+        t.addRow({ "BB", "World, again" });
+        t.addRow({ "CC", "Extraordinary" });
+        t.format();
+        TableStats stats = t.stats();
+#if IONIC_STATS
+        TEST(stats.rowsAdded == 3);
+        TEST(stats.formats == 1);
+        TEST(stats.cellsWrapped == 6);
+        TEST(stats.linesEmitted == 4);      // "World, again" wraps
+        TEST(stats.truncations == 1);       // "Extraordinary" doesn't fit in 6
+        TEST(stats.textBytes == 2 + 5 + 2 + 6 + 5 + 2 + 4);
+        TEST(stats.escapeBytes == 0);
+        TEST(stats.cellBytes > 0);
+        t.resetStats();
+        TEST(t.stats().formats == 0);
+#else
+        TEST(stats.rowsAdded == 0 && stats.formats == 0 && stats.cellBytes == 0);
+#endif
     }
     {
         std::string t = ionic::Table::colorize(ionic::Color::red, "Hello");